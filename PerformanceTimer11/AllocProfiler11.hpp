@@ -0,0 +1,276 @@
+// ==================================================================
+// BSD 3-Clause License
+//
+// Copyright (c) 2017-2020, Alexander K. Freed
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// ==================================================================
+
+
+// Language: ISO C++11
+
+// Counts allocations, bytes and time spent in the allocator on the current thread,
+// and a timer that reports them for each measured section.
+//
+// The counters are only fed when the global operator new/delete replacements are
+// compiled in. Define PERFORMANCETIMER11_ALLOC_INTERPOSER in exactly ONE source file
+// before including this header:
+//     #define PERFORMANCETIMER11_ALLOC_INTERPOSER
+//     #include "AllocProfiler11.hpp"
+
+#pragma once
+
+#include "TickClock11.hpp"
+#include "PerformanceTimer11.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+//! Allocator activity on one thread. The values only ever increase.
+struct AllocCounters11
+{
+    std::uint64_t      allocations;  //!< Number of calls to operator new.
+    std::uint64_t      bytes;        //!< Bytes requested from operator new.
+    std::uint64_t      frees;        //!< Number of calls to operator delete with a non-null pointer.
+    TickClock11::Ticks ticks;        //!< Time spent inside operator new and delete.
+};
+
+//! Per-thread allocation accounting used by the operator new/delete replacements.
+class AllocProfiler11
+{
+public:
+    //! @return true if the operator new/delete replacements are linked in.
+    static bool IsInterposed()
+    {
+        return Interposed().load(std::memory_order_relaxed);
+    }
+
+    //! @return true if the time spent in the allocator is measured.
+    static bool IsTimed()
+    {
+        return Timed().load(std::memory_order_relaxed);
+    }
+
+    //! Enable or disable timing of allocator calls for all threads. Counting is always on.
+    //! Timing adds two clock reads to every allocation. Default is enabled.
+    static void SetTimed(bool timed)
+    {
+        Timed().store(timed, std::memory_order_relaxed);
+    }
+
+    //! @return A snapshot of the counters for the calling thread.
+    static AllocCounters11 GetThreadCounters()
+    {
+        return Counters();
+    }
+
+    //! Allocate with malloc and account for it. Used by the replacement operator new.
+    //! @return The allocation, or nullptr if malloc failed.
+    static void* Allocate(std::size_t size)
+    {
+        ThreadState& state = Counters();
+        if (state.inside)
+            return std::malloc(size == 0 ? 1 : size);
+        state.inside = true;
+        const bool timed = IsTimed();
+        const TickClock11::Ticks begin = timed ? TickClock11::Now() : 0;
+        void* p = std::malloc(size == 0 ? 1 : size);
+        if (timed)
+            state.ticks += TickClock11::Now() - begin;
+        ++state.allocations;
+        state.bytes += size;
+        state.inside = false;
+        return p;
+    }
+
+    //! Free with free() and account for it. Used by the replacement operator delete.
+    static void Deallocate(void* p)
+    {
+        if (p == nullptr)
+            return;
+        ThreadState& state = Counters();
+        if (state.inside)
+        {
+            std::free(p);
+            return;
+        }
+        state.inside = true;
+        const bool timed = IsTimed();
+        const TickClock11::Ticks begin = timed ? TickClock11::Now() : 0;
+        std::free(p);
+        if (timed)
+            state.ticks += TickClock11::Now() - begin;
+        ++state.frees;
+        state.inside = false;
+    }
+
+    //! Marks the replacements as linked in. Only for use by the interposer below.
+    struct InterposedMarker
+    {
+        InterposedMarker() { Interposed().store(true, std::memory_order_relaxed); }
+    };
+
+private:
+    // Zero-initialized with no constructor or destructor, so the thread_local needs no
+    // dynamic initialization and cannot itself allocate.
+    struct ThreadState : AllocCounters11
+    {
+        bool inside;
+    };
+
+    static ThreadState& Counters()
+    {
+        static thread_local ThreadState state;
+        return state;
+    }
+
+    static std::atomic<bool>& Interposed()
+    {
+        static std::atomic<bool> interposed(false);
+        return interposed;
+    }
+
+    static std::atomic<bool>& Timed()
+    {
+        static std::atomic<bool> timed(true);
+        return timed;
+    }
+};
+
+//! A PerformanceTimer11 that also reports the allocator activity of the calling thread
+//! between Start() and Stop(). Start() and Stop() must be called on the same thread.
+class AllocTimer11 : public PerformanceTimer11
+{
+public:
+    AllocTimer11()
+        : m_start()
+        , m_stop()
+    {
+    }
+
+    //! Mark the current time and allocation counters as the start and stop point.
+    void Start()
+    {
+        m_start = AllocProfiler11::GetThreadCounters();
+        m_stop = m_start;
+        PerformanceTimer11::Start();
+    }
+
+    //! Mark the current time and allocation counters as the stop point.
+    void Stop()
+    {
+        PerformanceTimer11::Stop();
+        m_stop = AllocProfiler11::GetThreadCounters();
+    }
+
+    //! @return The number of allocations from start to stop.
+    std::uint64_t GetAllocations() const
+    {
+        return m_stop.allocations - m_start.allocations;
+    }
+
+    //! @return The number of bytes allocated from start to stop.
+    std::uint64_t GetAllocatedBytes() const
+    {
+        return m_stop.bytes - m_start.bytes;
+    }
+
+    //! @return The number of frees from start to stop.
+    std::uint64_t GetFrees() const
+    {
+        return m_stop.frees - m_start.frees;
+    }
+
+    //! @return The time spent in operator new and delete from start to stop in milliseconds.
+    double GetAllocatorTime() const
+    {
+        return TickClock11::ToMilliseconds(m_stop.ticks - m_start.ticks);
+    }
+
+private:
+    AllocCounters11 m_start;
+    AllocCounters11 m_stop;
+};
+
+
+#if defined(PERFORMANCETIMER11_ALLOC_INTERPOSER)
+
+// ===========================================================================
+// The global operator new/delete replacements
+
+namespace
+{
+    AllocProfiler11::InterposedMarker g_performanceTimer11AllocInterposed;
+
+    void* PerformanceTimer11New(std::size_t size)
+    {
+        for (;;)
+        {
+            void* p = AllocProfiler11::Allocate(size);
+            if (p != nullptr)
+                return p;
+            std::new_handler handler = std::get_new_handler();
+            if (handler == nullptr)
+                throw std::bad_alloc();
+            handler();
+        }
+    }
+
+    void* PerformanceTimer11NewNoThrow(std::size_t size) noexcept
+    {
+        try
+        {
+            return PerformanceTimer11New(size);
+        }
+        catch (...)
+        {
+            return nullptr;
+        }
+    }
+}
+
+void* operator new(std::size_t size) { return PerformanceTimer11New(size); }
+void* operator new[](std::size_t size) { return PerformanceTimer11New(size); }
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept { return PerformanceTimer11NewNoThrow(size); }
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept { return PerformanceTimer11NewNoThrow(size); }
+
+void operator delete(void* p) noexcept { AllocProfiler11::Deallocate(p); }
+void operator delete[](void* p) noexcept { AllocProfiler11::Deallocate(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { AllocProfiler11::Deallocate(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { AllocProfiler11::Deallocate(p); }
+
+#if defined(__cpp_sized_deallocation)
+void operator delete(void* p, std::size_t) noexcept { AllocProfiler11::Deallocate(p); }
+void operator delete[](void* p, std::size_t) noexcept { AllocProfiler11::Deallocate(p); }
+#endif
+
+// Over-aligned allocations (C++17) are left to the standard library's operators.
+
+#endif  // defined(PERFORMANCETIMER11_ALLOC_INTERPOSER)
@@ -0,0 +1,260 @@
+// ==================================================================
+// BSD 3-Clause License
+//
+// Copyright (c) 2017-2020, Alexander K. Freed
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// ==================================================================
+
+
+// Language: ISO C++11
+
+// Maps raw fast ticks (the TSC on x86, the virtual counter on ARM64) to CLOCK_MONOTONIC
+// and wall-clock time. Hot paths record only the fast ticks; the correlator samples
+// (fast, monotonic, realtime) triples now and then and converts at export time by
+// interpolating between them.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+//! One correlated sample of the three clocks. Times are in nanoseconds.
+struct ClockAnchor11
+{
+    std::int64_t fast;         //!< Fast ticks (see ClockCorrelator11::ReadFast()).
+    std::int64_t monotonic;    //!< std::chrono::steady_clock (CLOCK_MONOTONIC on Linux).
+    std::int64_t realtime;     //!< std::chrono::system_clock (CLOCK_REALTIME).
+    std::int64_t uncertainty;  //!< Width of the monotonic reads bracketing the others.
+};
+
+//! Keeps a piecewise-linear mapping from fast ticks to monotonic and wall-clock time.
+//! Call Sample() periodically, or StartSampling() to do it on a background thread.
+class ClockCorrelator11
+{
+public:
+    //! Takes two anchors about 2 ms apart, so fast ticks can be converted from the start.
+    //! Conversions get more precise as the anchors spread out over time.
+    //! @param[in] capacity The number of anchors kept. Older ones are dropped, and
+    //! conversions before the oldest anchor extrapolate from it.
+    explicit ClockCorrelator11(std::size_t capacity = 256)
+        : m_capacity(std::max<std::size_t>(capacity, 2))
+        , m_running(false)
+    {
+        Sample();
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        Sample();
+    }
+
+    ~ClockCorrelator11()
+    {
+        StopSampling();
+    }
+
+    ClockCorrelator11(const ClockCorrelator11&) = delete;
+    ClockCorrelator11& operator=(const ClockCorrelator11&) = delete;
+
+    //! Read the fastest counter available: the TSC on x86, cntvct_el0 on ARM64, and
+    //! steady_clock nanoseconds elsewhere. Only meaningful relative to other reads
+    //! on the same machine; convert with the functions below.
+    //! @return The current fast ticks.
+    static std::int64_t ReadFast()
+    {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+        return static_cast<std::int64_t>(__rdtsc());
+#elif defined(__x86_64__) || defined(__i386__)
+        return static_cast<std::int64_t>(__rdtsc());
+#elif defined(__aarch64__)
+        std::uint64_t ticks;
+        asm volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+        return static_cast<std::int64_t>(ticks);
+#else
+        return Monotonic();
+#endif
+    }
+
+    //! Take one anchor. The fast and realtime reads are bracketed by two monotonic
+    //! reads; of several attempts, the one with the narrowest bracket is kept so that
+    //! preemption or an interrupt during the reads doesn't skew it.
+    //! @param[in] attempts The number of attempts.
+    //! @return The anchor that was added.
+    ClockAnchor11 Sample(int attempts = 8)
+    {
+        ClockAnchor11 best = ClockAnchor11();
+        best.uncertainty = INT64_MAX;
+        for (int i = 0; i < attempts; ++i)
+        {
+            const std::int64_t before = Monotonic();
+            const std::int64_t fast = ReadFast();
+            const std::int64_t realtime = Realtime();
+            const std::int64_t after = Monotonic();
+            if (after - before < best.uncertainty)
+            {
+                best.fast = fast;
+                best.monotonic = before + (after - before) / 2;
+                best.realtime = realtime;
+                best.uncertainty = after - before;
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        // The counters can't go backwards, but guard against an unsynchronized TSC.
+        if (m_anchors.empty() || best.fast > m_anchors.back().fast)
+        {
+            m_anchors.push_back(best);
+            if (m_anchors.size() > m_capacity)
+                m_anchors.pop_front();
+        }
+        return best;
+    }
+
+    //! Call Sample() every period on a background thread until StopSampling().
+    //! @param[in] periodMilliseconds The time between anchors.
+    void StartSampling(double periodMilliseconds = 1000)
+    {
+        StopSampling();
+        m_running = true;
+        m_thread = std::thread([this, periodMilliseconds] {
+            std::unique_lock<std::mutex> lock(m_threadMutex);
+            const auto period = std::chrono::duration<double, std::milli>(periodMilliseconds);
+            while (!m_wake.wait_for(lock, period, [this] { return !m_running; }))
+                Sample();
+        });
+    }
+
+    //! Stop the background thread started by StartSampling().
+    void StopSampling()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_threadMutex);
+            m_running = false;
+        }
+        m_wake.notify_all();
+        if (m_thread.joinable())
+            m_thread.join();
+    }
+
+    //! @return true if there are enough anchors (two) to convert fast ticks. Only false
+    //!         if the fast counter didn't advance during construction.
+    bool IsCalibrated() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_anchors.size() >= 2;
+    }
+
+    //! @return The monotonic time in nanoseconds corresponding to the fast ticks, or -1
+    //!         if not IsCalibrated().
+    std::int64_t FastToMonotonic(std::int64_t fast) const
+    {
+        return Interpolate(fast, &ClockAnchor11::fast, &ClockAnchor11::monotonic);
+    }
+
+    //! @return The wall-clock time in nanoseconds since the epoch corresponding to the
+    //!         fast ticks, or -1 if not IsCalibrated().
+    std::int64_t FastToRealtime(std::int64_t fast) const
+    {
+        return Interpolate(fast, &ClockAnchor11::fast, &ClockAnchor11::realtime);
+    }
+
+    //! @return The wall-clock time in nanoseconds since the epoch corresponding to the monotonic time.
+    std::int64_t MonotonicToRealtime(std::int64_t monotonic) const
+    {
+        return Interpolate(monotonic, &ClockAnchor11::monotonic, &ClockAnchor11::realtime);
+    }
+
+    //! @return The fast tick rate in ticks per second, measured over the kept anchors.
+    double GetFastFrequency() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_anchors.size() < 2 || m_anchors.back().monotonic == m_anchors.front().monotonic)
+            return 0;
+        return 1e9 * static_cast<double>(m_anchors.back().fast - m_anchors.front().fast)
+            / static_cast<double>(m_anchors.back().monotonic - m_anchors.front().monotonic);
+    }
+
+    //! @return The steady_clock time in nanoseconds.
+    static std::int64_t Monotonic()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    //! @return The system_clock time in nanoseconds since the epoch.
+    static std::int64_t Realtime()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+private:
+    // Linear interpolation on the segment containing x, or extrapolation from the first
+    // or last segment. With a single anchor, only monotonic and realtime (both
+    // nanoseconds) can be converted; the fast tick rate is unknown.
+    std::int64_t Interpolate(std::int64_t x, std::int64_t ClockAnchor11::* from, std::int64_t ClockAnchor11::* to) const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_anchors.size() == 1)
+        {
+            if (from == &ClockAnchor11::fast)
+                return -1;
+            return m_anchors.front().*to + (x - m_anchors.front().*from);
+        }
+
+        auto upper = std::upper_bound(m_anchors.begin(), m_anchors.end(), x,
+            [from](std::int64_t value, const ClockAnchor11& anchor) { return value < anchor.*from; });
+        if (upper == m_anchors.begin())
+            ++upper;
+        else if (upper == m_anchors.end())
+            --upper;
+        const ClockAnchor11& a = *(upper - 1);
+        const ClockAnchor11& b = *upper;
+        const double slope = static_cast<double>(b.*to - a.*to) / static_cast<double>(b.*from - a.*from);
+        return a.*to + static_cast<std::int64_t>(slope * static_cast<double>(x - a.*from));
+    }
+
+    const std::size_t         m_capacity;
+    mutable std::mutex        m_mutex;
+    std::deque<ClockAnchor11> m_anchors;
+
+    std::mutex              m_threadMutex;
+    std::condition_variable m_wake;
+    bool                    m_running;
+    std::thread             m_thread;
+};
@@ -0,0 +1,308 @@
+// ==================================================================
+// BSD 3-Clause License
+//
+// Copyright (c) 2017-2020, Alexander K. Freed
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// ==================================================================
+
+
+// Language: ISO C++11
+
+#pragma once
+
+#include "TickClock11.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+//! A recorded span. Times are TickClock11 ticks.
+struct SpanRecord11
+{
+    std::uint64_t      id;      //!< Unique, non-zero.
+    std::uint64_t      parent;  //!< The enclosing span, or 0. A parent can't end before its children.
+    TickClock11::Ticks start;
+    TickClock11::Ticks end;
+    std::uint32_t      stage;   //!< Id from CriticalPath11::RegisterStage().
+};
+
+//! Finds the critical path through recorded spans and how much slack every span has.
+//!
+//! Spans form a DAG: a span depends on its children, and on the spans it follows from
+//! (e.g. the previous stage of a pipeline). A span's ready time is the end of its
+//! latest-ending dependency; the time from then to its end is its contribution. The
+//! critical path is found by walking back from the last span to end, always through
+//! the latest-ending dependency. Slack is how long a span could have been delayed
+//! without delaying the end, given the observed times.
+//! Both passes visit every span and dependency once (Kahn's topological order).
+class CriticalPath11
+{
+public:
+    static const std::uint32_t NoSpan = 0xFFFFFFFF;
+
+    //! @param[in] name The stage name (e.g. "decode").
+    //! @return The id to record spans of the stage with.
+    std::uint32_t RegisterStage(const std::string& name)
+    {
+        m_stageNames.push_back(name);
+        return static_cast<std::uint32_t>(m_stageNames.size() - 1);
+    }
+
+    //! Reserve memory for the given number of spans.
+    void Reserve(std::size_t spans)
+    {
+        m_spans.reserve(spans);
+        m_index.reserve(spans);
+    }
+
+    //! Add a span. Its parent doesn't have to be added first.
+    void AddSpan(const SpanRecord11& span)
+    {
+        m_index[span.id] = static_cast<std::uint32_t>(m_spans.size());
+        m_spans.push_back(span);
+    }
+
+    //! Record that a span can't start until another one has ended.
+    //! @param[in] from The earlier span.
+    //! @param[in] to The span that follows from it.
+    void AddFollowsFrom(std::uint64_t from, std::uint64_t to)
+    {
+        m_followsFrom.push_back(std::make_pair(from, to));
+    }
+
+    //! Build the graph and compute the critical path and slack.
+    //! @return false if there are no spans or the dependencies contain a cycle.
+    bool Analyze()
+    {
+        const std::size_t count = m_spans.size();
+        m_path.clear();
+        m_slack.assign(count, 0);
+        m_contribution.assign(count, 0);
+        if (count == 0)
+            return false;
+
+        // Dependency edges (before -> after), in compressed adjacency lists both ways.
+        std::vector<std::pair<std::uint32_t, std::uint32_t>> edges;
+        edges.reserve(count + m_followsFrom.size());
+        for (std::uint32_t i = 0; i < count; ++i)
+        {
+            const std::uint32_t parent = Find(m_spans[i].parent);
+            if (parent != NoSpan)
+                edges.push_back(std::make_pair(i, parent));
+        }
+        for (const auto& link : m_followsFrom)
+        {
+            const std::uint32_t from = Find(link.first);
+            const std::uint32_t to = Find(link.second);
+            if (from != NoSpan && to != NoSpan)
+                edges.push_back(std::make_pair(from, to));
+        }
+        std::vector<std::uint32_t> succOffsets, succs, predOffsets, preds;
+        BuildAdjacency(count, edges, false, succOffsets, succs);
+        BuildAdjacency(count, edges, true, predOffsets, preds);
+
+        // Topological order.
+        std::vector<std::uint32_t> order;
+        order.reserve(count);
+        std::vector<std::uint32_t> pending(count);
+        for (std::uint32_t i = 0; i < count; ++i)
+        {
+            pending[i] = predOffsets[i + 1] - predOffsets[i];
+            if (pending[i] == 0)
+                order.push_back(i);
+        }
+        for (std::size_t next = 0; next < order.size(); ++next)
+        {
+            const std::uint32_t node = order[next];
+            for (std::uint32_t e = succOffsets[node]; e < succOffsets[node + 1]; ++e)
+            {
+                if (--pending[succs[e]] == 0)
+                    order.push_back(succs[e]);
+            }
+        }
+        if (order.size() != count)
+            return false;
+
+        // Ready time and the dependency that determined it.
+        std::vector<TickClock11::Ticks> ready(count);
+        std::vector<std::uint32_t> blocker(count, std::uint32_t(NoSpan));
+        std::uint32_t sink = 0;
+        for (std::uint32_t i = 0; i < count; ++i)
+        {
+            ready[i] = m_spans[i].start;
+            for (std::uint32_t e = predOffsets[i]; e < predOffsets[i + 1]; ++e)
+            {
+                const std::uint32_t pred = preds[e];
+                if (blocker[i] == NoSpan || m_spans[pred].end > m_spans[blocker[i]].end)
+                    blocker[i] = pred;
+            }
+            if (blocker[i] != NoSpan)
+                ready[i] = m_spans[blocker[i]].end;
+            m_contribution[i] = std::max<TickClock11::Ticks>(0, m_spans[i].end - ready[i]);
+            if (m_spans[i].end > m_spans[sink].end)
+                sink = i;
+        }
+
+        // Latest finish, in reverse topological order.
+        const TickClock11::Ticks finish = m_spans[sink].end;
+        for (std::size_t n = count; n-- > 0;)
+        {
+            const std::uint32_t node = order[n];
+            TickClock11::Ticks latest = finish;
+            for (std::uint32_t e = succOffsets[node]; e < succOffsets[node + 1]; ++e)
+            {
+                const std::uint32_t succ = succs[e];
+                latest = std::min(latest, ready[succ] + m_slack[succ]);
+            }
+            m_slack[node] = std::max<TickClock11::Ticks>(0, latest - m_spans[node].end);
+        }
+
+        for (std::uint32_t node = sink; node != NoSpan; node = blocker[node])
+            m_path.push_back(node);
+        std::reverse(m_path.begin(), m_path.end());
+        m_length = finish - m_spans[m_path.front()].start;
+        return true;
+    }
+
+    //! @return The ids of the spans on the critical path, first to last.
+    std::vector<std::uint64_t> GetPath() const
+    {
+        std::vector<std::uint64_t> path;
+        path.reserve(m_path.size());
+        for (std::uint32_t node : m_path)
+            path.push_back(m_spans[node].id);
+        return path;
+    }
+
+    //! @return The length of the critical path in milliseconds.
+    double GetLength() const
+    {
+        return TickClock11::ToMilliseconds(m_length);
+    }
+
+    //! @return The slack of a span in milliseconds, or -1 if it is unknown.
+    double GetSlack(std::uint64_t id) const
+    {
+        const std::uint32_t node = Find(id);
+        return node == NoSpan || node >= m_slack.size() ? -1 : TickClock11::ToMilliseconds(m_slack[node]);
+    }
+
+    //! Write the stages ordered by their time on the critical path. Shortening a stage
+    //! shortens the end-to-end time by at most its critical time; stages with slack
+    //! and no critical time won't help at all.
+    //! @param[in] os The stream to write to.
+    //! @param[in] maxStages The maximum number of stages to list.
+    void Report(std::ostream& os, std::size_t maxStages = 20) const
+    {
+        struct Stage
+        {
+            std::uint32_t      id;
+            std::size_t        spans;
+            std::size_t        critical;
+            TickClock11::Ticks criticalTicks;
+            TickClock11::Ticks totalTicks;
+            TickClock11::Ticks minSlack;
+        };
+        std::vector<Stage> stages(m_stageNames.size() + 1);
+        for (std::size_t s = 0; s < stages.size(); ++s)
+            stages[s] = Stage{ static_cast<std::uint32_t>(s), 0, 0, 0, 0, INT64_MAX };
+        for (std::size_t i = 0; i < m_spans.size() && i < m_slack.size(); ++i)
+        {
+            Stage& stage = stages[std::min<std::size_t>(m_spans[i].stage, m_stageNames.size())];
+            ++stage.spans;
+            stage.totalTicks += m_spans[i].end - m_spans[i].start;
+            stage.minSlack = std::min(stage.minSlack, m_slack[i]);
+        }
+        for (std::uint32_t node : m_path)
+        {
+            Stage& stage = stages[std::min<std::size_t>(m_spans[node].stage, m_stageNames.size())];
+            ++stage.critical;
+            stage.criticalTicks += m_contribution[node];
+        }
+        stages.erase(std::remove_if(stages.begin(), stages.end(), [](const Stage& s) { return s.spans == 0; }), stages.end());
+        std::sort(stages.begin(), stages.end(), [](const Stage& a, const Stage& b) { return a.criticalTicks > b.criticalTicks; });
+        if (stages.size() > maxStages)
+            stages.resize(maxStages);
+
+        os << "Critical path: " << std::fixed << std::setprecision(3) << GetLength() << " ms through "
+           << m_path.size() << " spans\n";
+        os << std::left << std::setw(24) << "stage" << std::right << std::setw(12) << "critical" << std::setw(8) << "share"
+           << std::setw(10) << "on.path" << std::setw(10) << "spans" << std::setw(12) << "total" << std::setw(12) << "min.slack" << '\n';
+        for (const Stage& stage : stages)
+        {
+            const double critical = TickClock11::ToMilliseconds(stage.criticalTicks);
+            os << std::left << std::setw(24) << (stage.id < m_stageNames.size() ? m_stageNames[stage.id] : "(none)")
+               << std::right << std::setw(12) << critical
+               << std::setw(7) << std::setprecision(1) << (m_length > 0 ? 100.0 * stage.criticalTicks / m_length : 0.0) << '%'
+               << std::setw(10) << stage.critical << std::setw(10) << stage.spans << std::setprecision(3)
+               << std::setw(12) << TickClock11::ToMilliseconds(stage.totalTicks)
+               << std::setw(12) << TickClock11::ToMilliseconds(stage.minSlack) << '\n';
+        }
+    }
+
+private:
+    std::uint32_t Find(std::uint64_t id) const
+    {
+        if (id == 0)
+            return NoSpan;
+        const auto it = m_index.find(id);
+        return it == m_index.end() ? std::uint32_t(NoSpan) : it->second;
+    }
+
+    static void BuildAdjacency(std::size_t count, const std::vector<std::pair<std::uint32_t, std::uint32_t>>& edges,
+        bool reversed, std::vector<std::uint32_t>& offsets, std::vector<std::uint32_t>& targets)
+    {
+        offsets.assign(count + 1, 0);
+        for (const auto& edge : edges)
+            ++offsets[(reversed ? edge.second : edge.first) + 1];
+        for (std::size_t i = 0; i < count; ++i)
+            offsets[i + 1] += offsets[i];
+        targets.resize(edges.size());
+        std::vector<std::uint32_t> fill(offsets.begin(), offsets.end() - 1);
+        for (const auto& edge : edges)
+        {
+            const std::uint32_t from = reversed ? edge.second : edge.first;
+            targets[fill[from]++] = reversed ? edge.first : edge.second;
+        }
+    }
+
+    std::vector<std::string>                            m_stageNames;
+    std::vector<SpanRecord11>                           m_spans;
+    std::unordered_map<std::uint64_t, std::uint32_t>    m_index;
+    std::vector<std::pair<std::uint64_t, std::uint64_t>> m_followsFrom;
+    std::vector<std::uint32_t>                          m_path;
+    std::vector<TickClock11::Ticks>                     m_slack;
+    std::vector<TickClock11::Ticks>                     m_contribution;
+    TickClock11::Ticks                                  m_length = 0;
+};
@@ -0,0 +1,290 @@
+// ==================================================================
+// BSD 3-Clause License
+//
+// Copyright (c) 2017-2020, Alexander K. Freed
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// ==================================================================
+
+
+// Language: ISO C++11
+
+// Energy measurement with the RAPL (Running Average Power Limit) counters of Intel and
+// AMD processors, alongside the elapsed time.
+//
+// The counters are read through the powercap sysfs interface
+// (/sys/class/powercap/intel-rapl:N/energy_uj), or the MSRs (/dev/cpu/0/msr, needs
+// the msr module and privileges) if sysfs isn't available. The files are opened once
+// and read with pread. Each read is a system call of a few microseconds, and the
+// counters themselves update about once a millisecond, so measure coarse sections
+// (a frame, a batch of operations) rather than individual calls.
+
+#pragma once
+
+#include "PerformanceTimer11.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+//! Reads the package energy counters. One instance is shared by all EnergyTimer11s.
+class EnergyMeter11
+{
+public:
+    //! @return The meter shared by the process.
+    static EnergyMeter11& Get()
+    {
+        static EnergyMeter11 meter;
+        return meter;
+    }
+
+    EnergyMeter11(const EnergyMeter11&) = delete;
+    EnergyMeter11& operator=(const EnergyMeter11&) = delete;
+
+    ~EnergyMeter11()
+    {
+#if defined(__linux__)
+        for (const Domain& domain : m_domains)
+            close(domain.fd);
+#endif
+    }
+
+    //! @return true if an energy counter could be opened.
+    bool IsSupportedPlatform() const
+    {
+        return !m_domains.empty();
+    }
+
+    //! @return The number of packages (sockets) being summed.
+    std::size_t GetDomainCount() const
+    {
+        return m_domains.size();
+    }
+
+    //! Read the raw counters of every package.
+    //! @param[out] counters One value per package, in counter units.
+    void Read(std::vector<std::uint64_t>& counters) const
+    {
+        counters.resize(m_domains.size());
+        for (std::size_t i = 0; i < m_domains.size(); ++i)
+            counters[i] = ReadCounter(m_domains[i]);
+    }
+
+    //! @return The energy between two reads in joules, summed over the packages. Each
+    //! counter may have wrapped around once.
+    double GetEnergy(const std::vector<std::uint64_t>& start, const std::vector<std::uint64_t>& stop) const
+    {
+        double joules = 0;
+        for (std::size_t i = 0; i < m_domains.size() && i < start.size() && i < stop.size(); ++i)
+        {
+            const Domain& domain = m_domains[i];
+            const std::uint64_t delta = stop[i] >= start[i] ? stop[i] - start[i] : stop[i] + domain.range - start[i];
+            joules += static_cast<double>(delta) * domain.joulesPerUnit;
+        }
+        return joules;
+    }
+
+private:
+    struct Domain
+    {
+        int           fd;
+        bool          msr;            // false: sysfs text in microjoules.
+        std::uint32_t msrAddress;
+        std::uint64_t range;          // The counter wraps to 0 at this value.
+        double        joulesPerUnit;
+    };
+
+    EnergyMeter11()
+    {
+#if defined(__linux__)
+        if (!OpenPowercap())
+            OpenMsr();
+#endif
+    }
+
+#if defined(__linux__)
+    // Top-level zones intel-rapl:0, intel-rapl:1, ... are the packages. (AMD processors
+    // use the same names.)
+    bool OpenPowercap()
+    {
+        for (int package = 0; package < 64; ++package)
+        {
+            char path[96];
+            std::snprintf(path, sizeof(path), "/sys/class/powercap/intel-rapl:%d/energy_uj", package);
+            const int fd = open(path, O_RDONLY | O_CLOEXEC);
+            if (fd < 0)
+                break;
+
+            Domain domain = Domain();
+            domain.fd = fd;
+            domain.joulesPerUnit = 1e-6;
+            domain.range = 0;
+            std::snprintf(path, sizeof(path), "/sys/class/powercap/intel-rapl:%d/max_energy_range_uj", package);
+            const int rangeFd = open(path, O_RDONLY | O_CLOEXEC);
+            if (rangeFd >= 0)
+            {
+                domain.range = ReadDecimal(rangeFd) + 1;
+                close(rangeFd);
+            }
+            if (domain.range <= 1)
+                domain.range = std::uint64_t(1) << 32;
+            m_domains.push_back(domain);
+        }
+        return !m_domains.empty();
+    }
+
+    // Intel: MSR_RAPL_POWER_UNIT (0x606) and MSR_PKG_ENERGY_STATUS (0x611).
+    // AMD:   0xC0010299 and 0xC001029B. Only the first package is read.
+    bool OpenMsr()
+    {
+        const int fd = open("/dev/cpu/0/msr", O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return false;
+        static const std::uint32_t units[] = { 0x606, 0xC0010299 };
+        static const std::uint32_t energy[] = { 0x611, 0xC001029B };
+        for (int vendor = 0; vendor < 2; ++vendor)
+        {
+            std::uint64_t unit = 0;
+            if (pread(fd, &unit, sizeof(unit), units[vendor]) != static_cast<ssize_t>(sizeof(unit)))
+                continue;
+            Domain domain = Domain();
+            domain.fd = fd;
+            domain.msr = true;
+            domain.msrAddress = energy[vendor];
+            domain.range = std::uint64_t(1) << 32;
+            // Energy status units are bits 12:8, in 1/2^ESU joules.
+            domain.joulesPerUnit = 1.0 / static_cast<double>(std::uint64_t(1) << ((unit >> 8) & 0x1F));
+            m_domains.push_back(domain);
+            return true;
+        }
+        close(fd);
+        return false;
+    }
+
+    static std::uint64_t ReadDecimal(int fd)
+    {
+        char buffer[32];
+        const ssize_t length = pread(fd, buffer, sizeof(buffer) - 1, 0);
+        if (length <= 0)
+            return 0;
+        buffer[length] = '\0';
+        return std::strtoull(buffer, nullptr, 10);
+    }
+#endif
+
+    static std::uint64_t ReadCounter(const Domain& domain)
+    {
+#if defined(__linux__)
+        if (!domain.msr)
+            return ReadDecimal(domain.fd);
+        std::uint64_t value = 0;
+        if (pread(domain.fd, &value, sizeof(value), domain.msrAddress) != static_cast<ssize_t>(sizeof(value)))
+            return 0;
+        return value & 0xFFFFFFFF;
+#else
+        (void)domain;
+        return 0;
+#endif
+    }
+
+    std::vector<Domain> m_domains;
+};
+
+//! A PerformanceTimer11 that also reports the processor package energy used between
+//! Start() and Stop(). The energy is for the whole package (all cores and processes),
+//! so it is most meaningful when the measured work dominates the machine.
+class EnergyTimer11 : public PerformanceTimer11
+{
+public:
+    EnergyTimer11()
+        : m_meter(EnergyMeter11::Get())
+        , m_operations(1)
+    {
+        m_meter.Read(m_start);
+        m_stop = m_start;
+    }
+
+    //! The counters are only available on Linux, with a processor and kernel that provide RAPL.
+    //! @return true if energy can be measured.
+    bool IsSupportedPlatform() const
+    {
+        return m_meter.IsSupportedPlatform();
+    }
+
+    //! Mark the current time and energy counters as the start and stop point.
+    void Start()
+    {
+        m_meter.Read(m_start);
+        m_stop = m_start;
+        PerformanceTimer11::Start();
+    }
+
+    //! Mark the current time and energy counters as the stop point.
+    void Stop()
+    {
+        PerformanceTimer11::Stop();
+        m_meter.Read(m_stop);
+    }
+
+    //! Set the number of operations done between start and stop, for GetEnergyPerOperation().
+    void SetOperations(std::uint64_t operations)
+    {
+        m_operations = operations;
+    }
+
+    //! @return The energy used from start to stop in joules.
+    double GetEnergy() const
+    {
+        return m_meter.GetEnergy(m_start, m_stop);
+    }
+
+    //! @return The energy per operation in joules.
+    double GetEnergyPerOperation() const
+    {
+        return m_operations == 0 ? 0 : GetEnergy() / static_cast<double>(m_operations);
+    }
+
+    //! @return The average power from start to stop in watts.
+    double GetAveragePower() const
+    {
+        const double elapsed = GetElapsed();
+        return elapsed > 0 ? GetEnergy() / (elapsed / 1000.0) : 0;
+    }
+
+private:
+    EnergyMeter11&             m_meter;
+    std::vector<std::uint64_t> m_start;
+    std::vector<std::uint64_t> m_stop;
+    std::uint64_t              m_operations;
+};
@@ -0,0 +1,163 @@
+// ==================================================================
+// BSD 3-Clause License
+//
+// Copyright (c) 2017-2020, Alexander K. Freed
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// ==================================================================
+
+
+// Language: ISO C++11
+
+#pragma once
+
+#include "TickClock11.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <vector>
+
+//! One of the slowest samples of a window, with the context the caller attached to it.
+template <std::size_t ContextSize>
+struct Exemplar11
+{
+    double             milliseconds;          //!< The sample.
+    TickClock11::Ticks recorded;              //!< When it was recorded.
+    std::size_t        contextSize;           //!< The number of bytes used in context.
+    unsigned char      context[ContextSize];  //!< e.g. a request id or the laps of the operation.
+
+    bool operator>(const Exemplar11& other) const
+    {
+        return milliseconds > other.milliseconds;
+    }
+};
+
+//! Keeps the K slowest samples of the current window, so that the requests behind a
+//! bad percentile can be found. Use it next to a LatencyHistogram11:
+//!     histogram.Record(timer.GetElapsed());
+//!     exemplars.Offer(timer.GetElapsed(), &requestId, sizeof(requestId));
+//! Samples that can't make the top K are rejected with a single compare against a
+//! cached watermark (the Kth slowest so far), so the fast path is one atomic load.
+//! Only samples that make it take a lock.
+template <std::size_t K = 8, std::size_t ContextSize = 32>
+class ExemplarReservoir11
+{
+    static_assert(K > 0 && ContextSize > 0, "ExemplarReservoir11 needs room for at least one exemplar and one byte of context");
+
+public:
+    using Exemplar = Exemplar11<ContextSize>;
+
+    ExemplarReservoir11()
+        : m_watermark(NotFull())
+    {
+        m_heap.reserve(K);
+    }
+
+    ExemplarReservoir11(const ExemplarReservoir11&) = delete;
+    ExemplarReservoir11& operator=(const ExemplarReservoir11&) = delete;
+
+    //! Offer a sample. Its context is only copied if it is among the K slowest.
+    //! @param[in] milliseconds The sample, e.g. PerformanceTimer11::GetElapsed().
+    //! @param[in] context The bytes to keep with it. Truncated to ContextSize.
+    //! @param[in] contextSize The number of bytes in context.
+    //! @return true if the sample was kept.
+    bool Offer(double milliseconds, const void* context = nullptr, std::size_t contextSize = 0)
+    {
+        if (!(milliseconds > m_watermark.load(std::memory_order_relaxed)))  // Also rejects NaN.
+            return false;
+        return Insert(milliseconds, context, contextSize);
+    }
+
+    //! @return The sample a new one must exceed to be kept, in milliseconds: the Kth
+    //!         slowest, or -infinity while fewer than K are kept.
+    double GetWatermark() const
+    {
+        return m_watermark.load(std::memory_order_relaxed);
+    }
+
+    //! End the current window.
+    //! @return The exemplars of the window, slowest first.
+    std::vector<Exemplar> TakeWindow()
+    {
+        std::vector<Exemplar> window;
+        window.reserve(K);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            window.swap(m_heap);
+            m_watermark.store(NotFull(), std::memory_order_relaxed);
+        }
+        std::sort(window.begin(), window.end(), std::greater<Exemplar>());
+        return window;
+    }
+
+private:
+    // The watermark until the heap holds K exemplars: every sample is kept.
+    static double NotFull()
+    {
+        return -std::numeric_limits<double>::infinity();
+    }
+
+    bool Insert(double milliseconds, const void* context, std::size_t contextSize)
+    {
+        Exemplar exemplar;
+        exemplar.milliseconds = milliseconds;
+        exemplar.recorded = TickClock11::Now();
+        exemplar.contextSize = std::min(contextSize, ContextSize);
+        if (exemplar.contextSize != 0)
+            std::memcpy(exemplar.context, context, exemplar.contextSize);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        // A min-heap on the sample, so the front is the one to evict.
+        if (m_heap.size() < K)
+        {
+            m_heap.push_back(exemplar);
+            std::push_heap(m_heap.begin(), m_heap.end(), std::greater<Exemplar>());
+        }
+        else if (milliseconds > m_heap.front().milliseconds)
+        {
+            std::pop_heap(m_heap.begin(), m_heap.end(), std::greater<Exemplar>());
+            m_heap.back() = exemplar;
+            std::push_heap(m_heap.begin(), m_heap.end(), std::greater<Exemplar>());
+        }
+        else
+        {
+            return false;
+        }
+        if (m_heap.size() == K)
+            m_watermark.store(m_heap.front().milliseconds, std::memory_order_relaxed);
+        return true;
+    }
+
+    std::atomic<double>   m_watermark;
+    std::mutex            m_mutex;
+    std::vector<Exemplar> m_heap;
+};
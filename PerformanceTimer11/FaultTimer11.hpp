@@ -0,0 +1,258 @@
+// ==================================================================
+// BSD 3-Clause License
+//
+// Copyright (c) 2017-2020, Alexander K. Freed
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// ==================================================================
+
+
+// Language: ISO C++11
+
+// A timer that attributes page faults (and optionally dTLB misses) to each measured
+// section and estimates how much of the elapsed time they account for.
+
+#pragma once
+
+#include "PerformanceTimer11.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+//! Fault counters of the calling thread at one point in time.
+struct FaultCounters11
+{
+    std::uint64_t minorFaults;  //!< Faults serviced without I/O.
+    std::uint64_t majorFaults;  //!< Faults that required I/O.
+    std::uint64_t tlbMisses;    //!< dTLB load misses. Only counted if enabled.
+};
+
+//! A PerformanceTimer11 that also samples the calling thread's page-fault counters at
+//! Start() and Stop(). Start() and Stop() must be called on the thread that constructed
+//! the timer when dTLB counting is enabled.
+class FaultTimer11 : public PerformanceTimer11
+{
+public:
+    //! @param[in] countTlbMisses Also count dTLB load misses through perf events.
+    explicit FaultTimer11(bool countTlbMisses = false)
+        : m_start()
+        , m_stop()
+        , m_tlbFd(-1)
+    {
+        if (countTlbMisses)
+            OpenTlbCounter();
+    }
+
+    ~FaultTimer11()
+    {
+#if defined(__linux__)
+        if (m_tlbFd >= 0)
+            close(m_tlbFd);
+#endif
+    }
+
+    FaultTimer11(const FaultTimer11&) = delete;
+    FaultTimer11& operator=(const FaultTimer11&) = delete;
+
+    //! Fault counters are only available on Linux.
+    //! @return true if this system is supported.
+    bool IsSupportedPlatform() const
+    {
+#if defined(__linux__)
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    //! @return true if dTLB misses are being counted. (perf events may be unavailable.)
+    bool IsCountingTlbMisses() const
+    {
+        return m_tlbFd >= 0;
+    }
+
+    //! Mark the current time and fault counters as the start and stop point.
+    void Start()
+    {
+        m_start = Sample();
+        m_stop = m_start;
+        PerformanceTimer11::Start();
+    }
+
+    //! Mark the current time and fault counters as the stop point.
+    void Stop()
+    {
+        PerformanceTimer11::Stop();
+        m_stop = Sample();
+    }
+
+    //! @return The number of minor faults from start to stop.
+    std::uint64_t GetMinorFaults() const
+    {
+        return m_stop.minorFaults - m_start.minorFaults;
+    }
+
+    //! @return The number of major faults from start to stop.
+    std::uint64_t GetMajorFaults() const
+    {
+        return m_stop.majorFaults - m_start.majorFaults;
+    }
+
+    //! @return The number of dTLB load misses from start to stop. 0 if not counting.
+    std::uint64_t GetTlbMisses() const
+    {
+        return m_stop.tlbMisses - m_start.tlbMisses;
+    }
+
+    //! @return The estimated time spent servicing faults from start to stop in milliseconds.
+    double GetFaultTime() const
+    {
+        return GetMinorFaults() * GetMinorFaultCost() + GetMajorFaults() * GetMajorFaultCost();
+    }
+
+    //! @param[in] fraction The share of the elapsed time, from 0 to 1.
+    //! @return true if the estimated fault time is at least the given share of the elapsed time.
+    bool FaultsDominate(double fraction = 0.5) const
+    {
+        const double elapsed = GetElapsed();
+        return elapsed > 0 && GetFaultTime() >= fraction * elapsed;
+    }
+
+    //! @return The estimated cost of one minor fault in milliseconds.
+    static double GetMinorFaultCost()
+    {
+        return MinorFaultCost().load(std::memory_order_relaxed);
+    }
+
+    //! @return The estimated cost of one major fault in milliseconds.
+    static double GetMajorFaultCost()
+    {
+        return MajorFaultCost().load(std::memory_order_relaxed);
+    }
+
+    //! Set the estimated cost of faults used by GetFaultTime(). Unit is milliseconds.
+    //! Defaults are 0.0005 (minor) and 0.1 (major). Major fault cost depends on the storage.
+    static void SetFaultCosts(double minorFault, double majorFault)
+    {
+        MinorFaultCost().store(minorFault, std::memory_order_relaxed);
+        MajorFaultCost().store(majorFault, std::memory_order_relaxed);
+    }
+
+    //! Measure the cost of a minor fault on this machine by touching freshly mapped pages,
+    //! and use it from now on.
+    //! @param[in] pages The number of pages to touch.
+    //! @return The measured cost in milliseconds, or the current estimate if unsupported.
+    static double CalibrateMinorFaultCost(std::size_t pages = 1024)
+    {
+#if defined(__linux__)
+        const long pageSize = sysconf(_SC_PAGESIZE);
+        const std::size_t length = pages * static_cast<std::size_t>(pageSize);
+        void* mapping = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapping == MAP_FAILED)
+            return GetMinorFaultCost();
+
+        FaultTimer11 timer;
+        timer.Start();
+        volatile char* bytes = static_cast<volatile char*>(mapping);
+        for (std::size_t offset = 0; offset < length; offset += static_cast<std::size_t>(pageSize))
+            bytes[offset] = 1;
+        timer.Stop();
+        munmap(mapping, length);
+
+        if (timer.GetMinorFaults() == 0)
+            return GetMinorFaultCost();
+        const double cost = timer.GetElapsed() / static_cast<double>(timer.GetMinorFaults());
+        MinorFaultCost().store(cost, std::memory_order_relaxed);
+        return cost;
+#else
+        (void)pages;
+        return GetMinorFaultCost();
+#endif
+    }
+
+private:
+    FaultCounters11 Sample() const
+    {
+        FaultCounters11 counters = FaultCounters11();
+#if defined(__linux__)
+        rusage usage;
+        if (getrusage(RUSAGE_THREAD, &usage) == 0)
+        {
+            counters.minorFaults = static_cast<std::uint64_t>(usage.ru_minflt);
+            counters.majorFaults = static_cast<std::uint64_t>(usage.ru_majflt);
+        }
+        if (m_tlbFd >= 0)
+        {
+            std::uint64_t value = 0;
+            if (read(m_tlbFd, &value, sizeof(value)) == static_cast<ssize_t>(sizeof(value)))
+                counters.tlbMisses = value;
+        }
+#endif
+        return counters;
+    }
+
+    void OpenTlbCounter()
+    {
+#if defined(__linux__)
+        perf_event_attr attr = perf_event_attr();
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_DTLB
+            | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+            | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        // Count the calling thread on any CPU.
+        m_tlbFd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+    }
+
+    static std::atomic<double>& MinorFaultCost()
+    {
+        static std::atomic<double> cost(0.0005);
+        return cost;
+    }
+
+    static std::atomic<double>& MajorFaultCost()
+    {
+        static std::atomic<double> cost(0.1);
+        return cost;
+    }
+
+    FaultCounters11 m_start;
+    FaultCounters11 m_stop;
+    int             m_tlbFd;
+};
@@ -0,0 +1,459 @@
+// ==================================================================
+// BSD 3-Clause License
+//
+// Copyright (c) 2017-2020, Alexander K. Freed
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// ==================================================================
+
+
+// Language: ISO C++11
+
+// Characterizes the timing stability of a loop regulated with SetInterval() and
+// IntervalHasElapsed(). Record the start of every iteration, then analyze:
+//
+//     PerformanceTimer11 timer;
+//     timer.SetInterval(1000);
+//     JitterAnalyzer11 jitter(1000);
+//     timer.Start();
+//     while (running)
+//     {
+//         timer.Stop();
+//         if (!timer.IntervalHasElapsed())
+//             continue;
+//         timer.Start();
+//         jitter.RecordTick();
+//         // LOOP BODY.
+//     }
+//     jitter.Report(std::cout);
+//
+// Lateness is the time between a tick's deadline (the previous tick plus the interval)
+// and its actual start. Phase error is the time between a tick's start and the ideal
+// grid (the first tick plus n intervals); it is the input to the Allan deviation.
+
+#pragma once
+
+#include "TickClock11.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/resource.h>
+#endif
+
+//! A histogram of tick lateness.
+struct JitterHistogram11
+{
+    double                     minimum;     //!< Lower edge of the first bin. Unit is milliseconds.
+    double                     binWidth;    //!< Unit is milliseconds.
+    std::vector<std::uint64_t> counts;
+};
+
+//! A peak in the spectrum of the lateness series.
+struct JitterPeak11
+{
+    double frequency;   //!< Unit is hertz.
+    double amplitude;   //!< Unit is milliseconds.
+};
+
+//! The likely cause of late ticks.
+enum JitterCause11
+{
+    JitterPreempted11,      //!< The thread was involuntarily switched out during the interval.
+    JitterWokeLate11,       //!< The thread slept (voluntary switch) and woke after the deadline.
+    JitterUnexplained11,    //!< No context switch: interrupts, SMIs, frequency changes, cache misses.
+    JitterCauseCount11
+};
+
+//! Late ticks attributed to one cause.
+struct JitterCauseStats11
+{
+    std::uint64_t ticks;        //!< Number of late ticks.
+    double        lateness;     //!< Total lateness. Unit is milliseconds.
+};
+
+//! Records tick start times of an interval-regulated loop and analyzes their jitter.
+//! RecordTick() must be called on the loop's thread. Everything else is for after the
+//! run, and must not run concurrently with RecordTick().
+class JitterAnalyzer11
+{
+public:
+    //! Preallocates the sample storage, so RecordTick() never allocates.
+    //! @param[in] ticksPerSecond The loop's interval, as passed to SetInterval().
+    //! @param[in] capacity The maximum number of ticks to record.
+    //! @param[in] trackContextSwitches Sample the thread's context-switch counters every
+    //!            tick, for GetCauses(). Costs a system call per tick.
+    explicit JitterAnalyzer11(double ticksPerSecond, std::size_t capacity = 65536, bool trackContextSwitches = true)
+        : m_period(TickClock11::TicksPerSecond() / ticksPerSecond)
+        , m_ticksPerSecond(ticksPerSecond)
+        , m_trackContextSwitches(trackContextSwitches)
+        , m_dropped(0)
+        , m_lastVoluntary(0)
+        , m_lastInvoluntary(0)
+    {
+        m_starts.reserve(capacity);
+        if (m_trackContextSwitches)
+        {
+            m_switches.reserve(capacity);
+            ReadContextSwitches(m_lastVoluntary, m_lastInvoluntary);
+        }
+    }
+
+    //! Record the start of a tick. Call as early in the loop body as possible.
+    void RecordTick()
+    {
+        const TickClock11::Ticks now = TickClock11::Now();
+        if (m_starts.size() == m_starts.capacity())
+        {
+            ++m_dropped;
+            return;
+        }
+        m_starts.push_back(now);
+        if (m_trackContextSwitches)
+        {
+            std::uint64_t voluntary = 0;
+            std::uint64_t involuntary = 0;
+            ReadContextSwitches(voluntary, involuntary);
+            Switches switches;
+            switches.voluntary = static_cast<std::uint32_t>(voluntary - m_lastVoluntary);
+            switches.involuntary = static_cast<std::uint32_t>(involuntary - m_lastInvoluntary);
+            m_switches.push_back(switches);
+            m_lastVoluntary = voluntary;
+            m_lastInvoluntary = involuntary;
+        }
+    }
+
+    //! Forget all recorded ticks.
+    void Clear()
+    {
+        m_starts.clear();
+        m_switches.clear();
+        m_dropped = 0;
+        if (m_trackContextSwitches)
+            ReadContextSwitches(m_lastVoluntary, m_lastInvoluntary);
+    }
+
+    //! @return The number of recorded ticks.
+    std::size_t GetTickCount() const
+    {
+        return m_starts.size();
+    }
+
+    //! @return The number of ticks that didn't fit in the storage.
+    std::uint64_t GetDropped() const
+    {
+        return m_dropped;
+    }
+
+    //! @return The lateness of every tick after the first. Unit is milliseconds. Ticks
+    //!         that started early (the loop body took less than one clock read) are negative.
+    std::vector<double> GetLateness() const
+    {
+        std::vector<double> lateness;
+        for (std::size_t i = 1; i < m_starts.size(); ++i)
+            lateness.push_back(LatenessOf(i));
+        return lateness;
+    }
+
+    //! @return The phase error of every tick. Unit is milliseconds.
+    std::vector<double> GetPhaseError() const
+    {
+        std::vector<double> phase;
+        for (std::size_t i = 0; i < m_starts.size(); ++i)
+        {
+            const double ideal = static_cast<double>(m_starts.front()) + m_period * static_cast<double>(i);
+            phase.push_back((static_cast<double>(m_starts[i]) - ideal) * 1000.0 / TickClock11::TicksPerSecond());
+        }
+        return phase;
+    }
+
+    //! @return A histogram of the lateness, over its full range.
+    //! @param[in] bins The number of bins.
+    JitterHistogram11 GetHistogram(std::size_t bins = 20) const
+    {
+        JitterHistogram11 histogram;
+        histogram.minimum = 0;
+        histogram.binWidth = 0;
+        const std::vector<double> lateness = GetLateness();
+        if (lateness.empty() || bins == 0)
+            return histogram;
+
+        const double low = *std::min_element(lateness.begin(), lateness.end());
+        const double high = *std::max_element(lateness.begin(), lateness.end());
+        histogram.minimum = low;
+        histogram.binWidth = high > low ? (high - low) / static_cast<double>(bins) : 1.0;
+        histogram.counts.assign(bins, 0);
+        for (double value : lateness)
+        {
+            const std::size_t bin = static_cast<std::size_t>((value - low) / histogram.binWidth);
+            ++histogram.counts[std::min(bin, bins - 1)];
+        }
+        return histogram;
+    }
+
+    //! The overlapping Allan deviation of the tick phase, at an averaging time of
+    //! `multiple` intervals. Falls as 1/tau for white phase noise and flattens or
+    //! rises where slow disturbances (thermal, frequency scaling) take over.
+    //! @return The deviation (dimensionless, fractional frequency), or 0 if there are too few ticks.
+    double GetAllanDeviation(std::size_t multiple) const
+    {
+        const std::size_t n = m_starts.size();
+        if (multiple == 0 || n < 2 * multiple + 1)
+            return 0;
+
+        const double tau = static_cast<double>(multiple) / m_ticksPerSecond;
+        const double secondsPerTick = 1.0 / TickClock11::TicksPerSecond();
+        double sum = 0;
+        for (std::size_t i = 0; i + 2 * multiple < n; ++i)
+        {
+            // The ideal grid cancels in the second difference, so raw start times suffice.
+            const double x0 = static_cast<double>(m_starts[i]);
+            const double x1 = static_cast<double>(m_starts[i + multiple]);
+            const double x2 = static_cast<double>(m_starts[i + 2 * multiple]);
+            const double d = (x2 - 2 * x1 + x0) * secondsPerTick;
+            sum += d * d;
+        }
+        const double count = static_cast<double>(n - 2 * multiple);
+        return std::sqrt(sum / (2 * tau * tau * count));
+    }
+
+    //! The largest peaks in the spectrum of the lateness series. A disturbance that
+    //! recurs at a fixed period (e.g. an interrupt every 4 ms) shows up as a peak at its
+    //! frequency, or at its alias if it is above half the loop rate.
+    //! @param[in] count The maximum number of peaks to return.
+    //! @return The peaks, largest first.
+    std::vector<JitterPeak11> GetSpectralPeaks(std::size_t count = 5) const
+    {
+        std::vector<JitterPeak11> peaks;
+        std::vector<double> lateness = GetLateness();
+        if (lateness.size() < 4)
+            return peaks;
+
+        // Remove the mean and apply a Hann window, then zero-pad to a power of two.
+        const std::size_t n = lateness.size();
+        double mean = 0;
+        for (double value : lateness)
+            mean += value;
+        mean /= static_cast<double>(n);
+        std::size_t size = 1;
+        while (size < n)
+            size <<= 1;
+        std::vector<std::complex<double>> spectrum(size);
+        const double pi = 3.14159265358979323846;
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            const double window = 0.5 - 0.5 * std::cos(2 * pi * static_cast<double>(i) / static_cast<double>(n - 1));
+            spectrum[i] = (lateness[i] - mean) * window;
+        }
+        Fft(spectrum);
+
+        // Local maxima of the one-sided magnitude, scaled to amplitude (Hann gain is 1/2).
+        const std::size_t half = size / 2;
+        std::vector<double> magnitude(half + 1);
+        for (std::size_t k = 0; k <= half; ++k)
+            magnitude[k] = std::abs(spectrum[k]) * 4.0 / static_cast<double>(n);
+        for (std::size_t k = 1; k < half; ++k)
+        {
+            if (magnitude[k] > magnitude[k - 1] && magnitude[k] >= magnitude[k + 1])
+            {
+                JitterPeak11 peak;
+                peak.frequency = static_cast<double>(k) * m_ticksPerSecond / static_cast<double>(size);
+                peak.amplitude = magnitude[k];
+                peaks.push_back(peak);
+            }
+        }
+        std::sort(peaks.begin(), peaks.end(), [](const JitterPeak11& a, const JitterPeak11& b) {
+            return a.amplitude > b.amplitude;
+        });
+        if (peaks.size() > count)
+            peaks.resize(count);
+        return peaks;
+    }
+
+    //! Attribute late ticks to a cause using the context switches seen during each interval.
+    //! Requires trackContextSwitches.
+    //! @param[in] threshold Ticks later than this are counted. Unit is milliseconds.
+    //! @param[out] causes Receives JitterCauseCount11 entries, indexed by JitterCause11.
+    void GetCauses(double threshold, JitterCauseStats11 (&causes)[JitterCauseCount11]) const
+    {
+        for (JitterCauseStats11& stats : causes)
+        {
+            stats.ticks = 0;
+            stats.lateness = 0;
+        }
+        if (!m_trackContextSwitches)
+            return;
+        for (std::size_t i = 1; i < m_starts.size(); ++i)
+        {
+            const double lateness = LatenessOf(i);
+            if (lateness <= threshold)
+                continue;
+            JitterCause11 cause = JitterUnexplained11;
+            if (m_switches[i].involuntary != 0)
+                cause = JitterPreempted11;
+            else if (m_switches[i].voluntary != 0)
+                cause = JitterWokeLate11;
+            ++causes[cause].ticks;
+            causes[cause].lateness += lateness;
+        }
+    }
+
+    //! Write a summary: lateness statistics and histogram, Allan deviation by octave,
+    //! spectral peaks, and causes of ticks later than 10% of the interval.
+    void Report(std::ostream& os) const
+    {
+        const std::vector<double> lateness = GetLateness();
+        os << "ticks " << m_starts.size() << ", dropped " << m_dropped << "\n";
+        if (lateness.empty())
+            return;
+
+        std::vector<double> sorted = lateness;
+        std::sort(sorted.begin(), sorted.end());
+        double mean = 0;
+        for (double value : sorted)
+            mean += value;
+        mean /= static_cast<double>(sorted.size());
+        double variance = 0;
+        for (double value : sorted)
+            variance += (value - mean) * (value - mean);
+        variance /= static_cast<double>(sorted.size());
+
+        os << std::fixed << std::setprecision(3);
+        os << "lateness (ms): mean " << mean << ", stddev " << std::sqrt(variance)
+           << ", p50 " << sorted[sorted.size() / 2]
+           << ", p99 " << sorted[sorted.size() * 99 / 100]
+           << ", max " << sorted.back() << "\n";
+
+        const JitterHistogram11 histogram = GetHistogram();
+        for (std::size_t i = 0; i < histogram.counts.size(); ++i)
+        {
+            os << "  " << std::setw(10) << histogram.minimum + histogram.binWidth * static_cast<double>(i)
+               << " ms  " << histogram.counts[i] << "\n";
+        }
+
+        os << std::scientific << std::setprecision(2);
+        os << "allan deviation:";
+        for (std::size_t multiple = 1; 2 * multiple < m_starts.size(); multiple *= 2)
+            os << " " << multiple << ":" << GetAllanDeviation(multiple);
+        os << "\n";
+
+        os << std::fixed << std::setprecision(3);
+        os << "spectral peaks:";
+        for (const JitterPeak11& peak : GetSpectralPeaks())
+            os << " " << peak.frequency << " Hz (" << peak.amplitude << " ms)";
+        os << "\n";
+
+        if (m_trackContextSwitches)
+        {
+            static const char* const names[JitterCauseCount11] = { "preempted", "woke late", "unexplained" };
+            JitterCauseStats11 causes[JitterCauseCount11];
+            GetCauses(m_period * 100.0 / TickClock11::TicksPerSecond(), causes);
+            for (int cause = 0; cause < JitterCauseCount11; ++cause)
+            {
+                os << "  " << std::left << std::setw(12) << names[cause] << std::right
+                   << causes[cause].ticks << " ticks, " << causes[cause].lateness << " ms\n";
+            }
+        }
+    }
+
+private:
+    struct Switches
+    {
+        std::uint32_t voluntary;
+        std::uint32_t involuntary;
+    };
+
+    double LatenessOf(std::size_t index) const
+    {
+        const double deadline = static_cast<double>(m_starts[index - 1]) + m_period;
+        return (static_cast<double>(m_starts[index]) - deadline) * 1000.0 / TickClock11::TicksPerSecond();
+    }
+
+    static void ReadContextSwitches(std::uint64_t& voluntary, std::uint64_t& involuntary)
+    {
+#if defined(__linux__)
+        rusage usage;
+        if (getrusage(RUSAGE_THREAD, &usage) == 0)
+        {
+            voluntary = static_cast<std::uint64_t>(usage.ru_nvcsw);
+            involuntary = static_cast<std::uint64_t>(usage.ru_nivcsw);
+            return;
+        }
+#endif
+        voluntary = 0;
+        involuntary = 0;
+    }
+
+    //! In-place iterative radix-2 FFT. The size must be a power of two.
+    static void Fft(std::vector<std::complex<double>>& data)
+    {
+        const std::size_t n = data.size();
+        for (std::size_t i = 1, j = 0; i < n; ++i)
+        {
+            std::size_t bit = n >> 1;
+            for (; j & bit; bit >>= 1)
+                j ^= bit;
+            j ^= bit;
+            if (i < j)
+                std::swap(data[i], data[j]);
+        }
+        const double pi = 3.14159265358979323846;
+        for (std::size_t length = 2; length <= n; length <<= 1)
+        {
+            const double angle = -2 * pi / static_cast<double>(length);
+            const std::complex<double> step(std::cos(angle), std::sin(angle));
+            for (std::size_t i = 0; i < n; i += length)
+            {
+                std::complex<double> w(1);
+                for (std::size_t k = 0; k < length / 2; ++k)
+                {
+                    const std::complex<double> even = data[i + k];
+                    const std::complex<double> odd = data[i + k + length / 2] * w;
+                    data[i + k] = even + odd;
+                    data[i + k + length / 2] = even - odd;
+                    w *= step;
+                }
+            }
+        }
+    }
+
+    double                  m_period;           // In clock ticks.
+    double                  m_ticksPerSecond;
+    bool                    m_trackContextSwitches;
+    std::uint64_t           m_dropped;
+    std::uint64_t           m_lastVoluntary;
+    std::uint64_t           m_lastInvoluntary;
+    std::vector<TickClock11::Ticks> m_starts;
+    std::vector<Switches>   m_switches;
+};
@@ -0,0 +1,159 @@
+// ==================================================================
+// BSD 3-Clause License
+//
+// Copyright (c) 2017-2020, Alexander K. Freed
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// ==================================================================
+
+
+// Language: ISO C++11
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+//! A fixed-size latency histogram with log-linear buckets (8 per power of two, so a
+//! value is reported within 12.5%). Recording is lock-free and safe from any thread.
+//! Values are recorded in milliseconds with microsecond resolution, up to about 19 hours.
+class LatencyHistogram11
+{
+public:
+    static const std::size_t SubBucketBits = 3;
+    static const std::size_t SubBuckets = std::size_t(1) << SubBucketBits;
+    static const std::size_t MaxBits = 36;  // 2^36 microseconds.
+    static const std::size_t BucketCount = (MaxBits - SubBucketBits + 1) * SubBuckets;
+
+    LatencyHistogram11()
+    {
+        Clear();
+    }
+
+    LatencyHistogram11(const LatencyHistogram11&) = delete;
+    LatencyHistogram11& operator=(const LatencyHistogram11&) = delete;
+
+    //! Record one sample.
+    //! @param[in] milliseconds The sample, e.g. PerformanceTimer11::GetElapsed().
+    void Record(double milliseconds)
+    {
+        m_buckets[BucketOf(ToMicroseconds(milliseconds))].fetch_add(1, std::memory_order_relaxed);
+        m_count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    //! @return The number of samples (after any decay).
+    std::uint64_t GetCount() const
+    {
+        return m_count.load(std::memory_order_relaxed);
+    }
+
+    //! @param[in] quantile The quantile, from 0 to 1. e.g. 0.99 for the 99th percentile.
+    //! @return The upper bound of the bucket containing the quantile in milliseconds, or 0 if empty.
+    double GetQuantile(double quantile) const
+    {
+        std::uint64_t total = 0;
+        for (std::size_t i = 0; i < BucketCount; ++i)
+            total += m_buckets[i].load(std::memory_order_relaxed);
+        if (total == 0)
+            return 0;
+
+        const std::uint64_t rank = std::max<std::uint64_t>(1,
+            static_cast<std::uint64_t>(std::min(1.0, std::max(0.0, quantile)) * static_cast<double>(total) + 0.5));
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i < BucketCount; ++i)
+        {
+            seen += m_buckets[i].load(std::memory_order_relaxed);
+            if (seen >= rank)
+                return static_cast<double>(UpperBoundOf(i)) / 1000.0;
+        }
+        return static_cast<double>(UpperBoundOf(BucketCount - 1)) / 1000.0;
+    }
+
+    //! Halve every count, so that recent samples outweigh old ones.
+    //! Concurrent Record() calls may be counted before or after the halving.
+    void Decay()
+    {
+        std::uint64_t total = 0;
+        for (std::size_t i = 0; i < BucketCount; ++i)
+        {
+            std::uint32_t count = m_buckets[i].load(std::memory_order_relaxed);
+            while (!m_buckets[i].compare_exchange_weak(count, count / 2, std::memory_order_relaxed))
+            {
+            }
+            total += count / 2;
+        }
+        m_count.store(total, std::memory_order_relaxed);
+    }
+
+    //! Remove all samples.
+    void Clear()
+    {
+        for (std::size_t i = 0; i < BucketCount; ++i)
+            m_buckets[i].store(0, std::memory_order_relaxed);
+        m_count.store(0, std::memory_order_relaxed);
+    }
+
+    //! @return The bucket index for a value in microseconds.
+    static std::size_t BucketOf(std::uint64_t microseconds)
+    {
+        if (microseconds < SubBuckets)
+            return static_cast<std::size_t>(microseconds);
+        std::size_t msb = 0;
+        for (std::uint64_t v = microseconds; v > 1; v >>= 1)
+            ++msb;
+        if (msb >= MaxBits)
+            return BucketCount - 1;
+        const std::size_t shift = msb - SubBucketBits;
+        return (shift + 1) * SubBuckets + static_cast<std::size_t>((microseconds >> shift) & (SubBuckets - 1));
+    }
+
+    //! @return The largest value in microseconds that falls in the bucket.
+    static std::uint64_t UpperBoundOf(std::size_t bucket)
+    {
+        if (bucket < SubBuckets)
+            return bucket;
+        const std::size_t shift = bucket / SubBuckets - 1;
+        const std::uint64_t subBucket = bucket % SubBuckets + SubBuckets;
+        return ((subBucket + 1) << shift) - 1;
+    }
+
+    //! @return The sample converted to whole microseconds, clamped at 0. NaN, infinity
+    //!         and values too large for 64 bits give UINT64_MAX (the top bucket).
+    static std::uint64_t ToMicroseconds(double milliseconds)
+    {
+        const double microseconds = milliseconds * 1000.0;
+        if (!(microseconds < 18446744073709551616.0))  // 2^64. Also true for NaN.
+            return UINT64_MAX;
+        return microseconds <= 0 ? 0 : static_cast<std::uint64_t>(microseconds);
+    }
+
+private:
+    std::atomic<std::uint32_t> m_buckets[BucketCount];
+    std::atomic<std::uint64_t> m_count;
+};
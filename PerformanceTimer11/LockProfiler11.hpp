@@ -0,0 +1,467 @@
+// ==================================================================
+// BSD 3-Clause License
+//
+// Copyright (c) 2017-2020, Alexander K. Freed
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// ==================================================================
+
+
+// Language: ISO C++11 (TimedSharedMutex11 requires C++17)
+
+// Drop-in lock wrappers that measure how long threads wait to acquire a lock and
+// how long they hold it. Statistics are kept per call site and sampled to keep the
+// uncontended path close to the cost of the bare lock.
+
+#pragma once
+
+#include "TickClock11.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+#if __cplusplus >= 201703L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)
+#include <shared_mutex>
+#define PERFORMANCETIMER11_HAS_SHARED_MUTEX 1
+#endif
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#endif
+
+//! Statistics for one place where a lock is acquired.
+//! Declare sites with PERFORMANCETIMER11_LOCK_SITE so each one is a function-local
+//! static that registers itself with LockProfiler11 the first time it runs.
+class LockSite11
+{
+public:
+    LockSite11(const char* name, const char* file, int line)
+        : m_name(name)
+        , m_file(file)
+        , m_line(line)
+        , m_next(nullptr)
+    {
+        Register();
+    }
+
+    LockSite11(const LockSite11&) = delete;
+    LockSite11& operator=(const LockSite11&) = delete;
+
+    const char* GetName() const { return m_name; }
+    const char* GetFile() const { return m_file; }
+    int         GetLine() const { return m_line; }
+
+    //! @return The number of sampled acquisitions.
+    std::uint64_t GetSampled() const { return m_sampled.load(std::memory_order_relaxed); }
+
+    //! @return The number of sampled acquisitions that had to wait for the lock.
+    std::uint64_t GetContended() const { return m_contended.load(std::memory_order_relaxed); }
+
+    //! @return The total wait time of the sampled acquisitions in milliseconds.
+    double GetWaitTime() const { return TickClock11::ToMilliseconds(m_waitTicks.load(std::memory_order_relaxed)); }
+
+    //! @return The longest sampled wait in milliseconds.
+    double GetMaxWaitTime() const { return TickClock11::ToMilliseconds(m_maxWaitTicks.load(std::memory_order_relaxed)); }
+
+    //! @return The number of sampled exclusive holds.
+    std::uint64_t GetHoldSamples() const { return m_holdSamples.load(std::memory_order_relaxed); }
+
+    //! @return The total hold time of the sampled exclusive holds in milliseconds.
+    double GetHoldTime() const { return TickClock11::ToMilliseconds(m_holdTicks.load(std::memory_order_relaxed)); }
+
+    //! @return The longest sampled exclusive hold in milliseconds.
+    double GetMaxHoldTime() const { return TickClock11::ToMilliseconds(m_maxHoldTicks.load(std::memory_order_relaxed)); }
+
+    //! @return The next registered site, or nullptr at the end of the list.
+    const LockSite11* GetNext() const { return m_next; }
+
+    //! Record one sampled acquisition.
+    void RecordWait(TickClock11::Ticks waitTicks, bool contended)
+    {
+        m_sampled.fetch_add(1, std::memory_order_relaxed);
+        if (!contended)
+            return;
+        m_contended.fetch_add(1, std::memory_order_relaxed);
+        m_waitTicks.fetch_add(waitTicks, std::memory_order_relaxed);
+        UpdateMax(m_maxWaitTicks, waitTicks);
+    }
+
+    //! Record one sampled exclusive hold.
+    void RecordHold(TickClock11::Ticks holdTicks)
+    {
+        m_holdSamples.fetch_add(1, std::memory_order_relaxed);
+        m_holdTicks.fetch_add(holdTicks, std::memory_order_relaxed);
+        UpdateMax(m_maxHoldTicks, holdTicks);
+    }
+
+    //! Clear the statistics. The site stays registered.
+    void Reset()
+    {
+        m_sampled.store(0, std::memory_order_relaxed);
+        m_contended.store(0, std::memory_order_relaxed);
+        m_waitTicks.store(0, std::memory_order_relaxed);
+        m_maxWaitTicks.store(0, std::memory_order_relaxed);
+        m_holdSamples.store(0, std::memory_order_relaxed);
+        m_holdTicks.store(0, std::memory_order_relaxed);
+        m_maxHoldTicks.store(0, std::memory_order_relaxed);
+    }
+
+    //! @return The head of the list of all registered sites.
+    static const LockSite11* GetFirst()
+    {
+        return Head().load(std::memory_order_acquire);
+    }
+
+private:
+    static std::atomic<LockSite11*>& Head()
+    {
+        static std::atomic<LockSite11*> head(nullptr);
+        return head;
+    }
+
+    // Sites are never unregistered, so a lock-free push is all the list needs.
+    void Register()
+    {
+        LockSite11* head = Head().load(std::memory_order_relaxed);
+        do
+        {
+            m_next = head;
+        } while (!Head().compare_exchange_weak(head, this, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    static void UpdateMax(std::atomic<TickClock11::Ticks>& max, TickClock11::Ticks value)
+    {
+        TickClock11::Ticks current = max.load(std::memory_order_relaxed);
+        while (value > current && !max.compare_exchange_weak(current, value, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    const char* m_name;
+    const char* m_file;
+    int         m_line;
+    LockSite11* m_next;
+
+    std::atomic<std::uint64_t>      m_sampled{0};
+    std::atomic<std::uint64_t>      m_contended{0};
+    std::atomic<TickClock11::Ticks> m_waitTicks{0};
+    std::atomic<TickClock11::Ticks> m_maxWaitTicks{0};
+    std::atomic<std::uint64_t>      m_holdSamples{0};
+    std::atomic<TickClock11::Ticks> m_holdTicks{0};
+    std::atomic<TickClock11::Ticks> m_maxHoldTicks{0};
+};
+
+//! Declare (once) and return the LockSite11 for the current source location.
+#define PERFORMANCETIMER11_LOCK_SITE(name) \
+    ([]() -> LockSite11& { static LockSite11 site((name), __FILE__, __LINE__); return site; }())
+
+//! Global sampling control and reporting for the timed locks.
+class LockProfiler11
+{
+public:
+    //! @return The sampling rate. One in every N acquisitions per thread is timed.
+    static std::uint32_t GetSampleRate()
+    {
+        return SampleRate().load(std::memory_order_relaxed);
+    }
+
+    //! Set the sampling rate. 1 times every acquisition. Default is 64.
+    //! @param[in] everyN Time one in every N acquisitions on each thread.
+    static void SetSampleRate(std::uint32_t everyN)
+    {
+        if (everyN == 0)
+        {
+            assert(false);
+            return;
+        }
+        SampleRate().store(everyN, std::memory_order_relaxed);
+    }
+
+    //! @return true if the current acquisition on this thread should be timed.
+    static bool ShouldSample()
+    {
+        static thread_local std::uint32_t countdown = 0;
+        static thread_local std::uint32_t random = 0x9E3779B9u;
+        if (countdown != 0)
+        {
+            --countdown;
+            return false;
+        }
+        // A fixed countdown would alias with loops that take several locks per
+        // iteration, so draw the gap uniformly from [0, 2N - 2] (mean N - 1).
+        random ^= random << 13;
+        random ^= random >> 17;
+        random ^= random << 5;
+        countdown = random % (2 * GetSampleRate() - 1);
+        return true;
+    }
+
+    //! Clear the statistics of every registered site.
+    static void Reset()
+    {
+        for (const LockSite11* site = LockSite11::GetFirst(); site != nullptr; site = site->GetNext())
+            const_cast<LockSite11*>(site)->Reset();
+    }
+
+    //! Write a table of the most contended sites, ordered by total wait time.
+    //! Counts and totals are scaled by the sampling rate to estimate the real values.
+    //! @param[in] os The stream to write to.
+    //! @param[in] maxSites The maximum number of sites to list.
+    static void Report(std::ostream& os, std::size_t maxSites = 10)
+    {
+        std::vector<const LockSite11*> sites;
+        for (const LockSite11* site = LockSite11::GetFirst(); site != nullptr; site = site->GetNext())
+        {
+            if (site->GetSampled() != 0)
+                sites.push_back(site);
+        }
+        std::sort(sites.begin(), sites.end(), [](const LockSite11* a, const LockSite11* b) {
+            return a->GetWaitTime() > b->GetWaitTime();
+        });
+        if (sites.size() > maxSites)
+            sites.resize(maxSites);
+
+        const double scale = GetSampleRate();
+        os << "Lock contention (sample rate 1/" << GetSampleRate() << ", times in ms)\n";
+        os << std::left << std::setw(24) << "site" << std::right
+           << std::setw(12) << "est.acq" << std::setw(10) << "cont.%"
+           << std::setw(12) << "est.wait" << std::setw(10) << "avg.wait" << std::setw(10) << "max.wait"
+           << std::setw(10) << "avg.hold" << std::setw(10) << "max.hold" << "  location\n";
+        for (const LockSite11* site : sites)
+        {
+            const double sampled   = static_cast<double>(site->GetSampled());
+            const double contended = static_cast<double>(site->GetContended());
+            const double holds     = static_cast<double>(site->GetHoldSamples());
+            os << std::left << std::setw(24) << site->GetName() << std::right << std::fixed
+               << std::setw(12) << std::setprecision(0) << sampled * scale
+               << std::setw(10) << std::setprecision(1) << 100.0 * contended / sampled
+               << std::setw(12) << std::setprecision(3) << site->GetWaitTime() * scale
+               << std::setw(10) << (contended != 0 ? site->GetWaitTime() / contended : 0.0)
+               << std::setw(10) << site->GetMaxWaitTime()
+               << std::setw(10) << (holds != 0 ? site->GetHoldTime() / holds : 0.0)
+               << std::setw(10) << site->GetMaxHoldTime()
+               << "  " << site->GetFile() << ':' << site->GetLine() << '\n';
+        }
+    }
+
+private:
+    static std::atomic<std::uint32_t>& SampleRate()
+    {
+        static std::atomic<std::uint32_t> rate(64);
+        return rate;
+    }
+};
+
+//! A test-and-test-and-set spinlock. Satisfies the Lockable requirements.
+class SpinLock11
+{
+public:
+    SpinLock11() = default;
+    SpinLock11(const SpinLock11&) = delete;
+    SpinLock11& operator=(const SpinLock11&) = delete;
+
+    void lock()
+    {
+        while (m_locked.exchange(true, std::memory_order_acquire))
+        {
+            while (m_locked.load(std::memory_order_relaxed))
+                Pause();
+        }
+    }
+
+    bool try_lock()
+    {
+        return !m_locked.load(std::memory_order_relaxed) && !m_locked.exchange(true, std::memory_order_acquire);
+    }
+
+    void unlock()
+    {
+        m_locked.store(false, std::memory_order_release);
+    }
+
+private:
+    static void Pause()
+    {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+        _mm_pause();
+#elif defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield");
+#endif
+    }
+
+    std::atomic<bool> m_locked{false};
+};
+
+//! Wraps any Lockable so that it can be used in its place (e.g. with std::lock_guard).
+//! Acquisitions through lock() are attributed to the site given at construction;
+//! use lock(site) or TimedLockGuard11 to attribute them to the call site instead.
+template <class Mutex>
+class TimedLock11
+{
+public:
+    //! @param[in] site The site that plain lock() calls are attributed to.
+    explicit TimedLock11(LockSite11& site)
+        : m_site(&site)
+    {
+    }
+
+    TimedLock11(const TimedLock11&) = delete;
+    TimedLock11& operator=(const TimedLock11&) = delete;
+
+    void lock()
+    {
+        lock(*m_site);
+    }
+
+    //! Acquire the lock and attribute the wait and hold time to the given site.
+    void lock(LockSite11& site)
+    {
+        if (!LockProfiler11::ShouldSample())
+        {
+            m_mutex.lock();
+            return;
+        }
+        const TickClock11::Ticks begin = TickClock11::Now();
+        bool contended = false;
+        if (!m_mutex.try_lock())
+        {
+            contended = true;
+            m_mutex.lock();
+        }
+        const TickClock11::Ticks acquired = TickClock11::Now();
+        site.RecordWait(acquired - begin, contended);
+        m_holdSite = &site;
+        m_holdStart = acquired;
+    }
+
+    bool try_lock()
+    {
+        return m_mutex.try_lock();
+    }
+
+    void unlock()
+    {
+        // Only the owner touches the hold fields, so they're read before the release.
+        LockSite11* const site = m_holdSite;
+        if (site != nullptr)
+        {
+            m_holdSite = nullptr;
+            site->RecordHold(TickClock11::Now() - m_holdStart);
+        }
+        m_mutex.unlock();
+    }
+
+    //! @return The wrapped lock.
+    Mutex& GetMutex() { return m_mutex; }
+
+protected:
+    Mutex              m_mutex;
+    LockSite11*        m_site;
+    LockSite11*        m_holdSite = nullptr;
+    TickClock11::Ticks m_holdStart = 0;
+};
+
+//! Adds the SharedLockable operations. Only the wait for a shared acquisition is
+//! timed, since several readers can hold the lock at once.
+template <class SharedMutex>
+class TimedSharedLock11 : public TimedLock11<SharedMutex>
+{
+public:
+    using TimedLock11<SharedMutex>::TimedLock11;
+
+    void lock_shared()
+    {
+        lock_shared(*this->m_site);
+    }
+
+    //! Acquire shared ownership and attribute the wait time to the given site.
+    void lock_shared(LockSite11& site)
+    {
+        if (!LockProfiler11::ShouldSample())
+        {
+            this->m_mutex.lock_shared();
+            return;
+        }
+        const TickClock11::Ticks begin = TickClock11::Now();
+        bool contended = false;
+        if (!this->m_mutex.try_lock_shared())
+        {
+            contended = true;
+            this->m_mutex.lock_shared();
+        }
+        site.RecordWait(TickClock11::Now() - begin, contended);
+    }
+
+    bool try_lock_shared()
+    {
+        return this->m_mutex.try_lock_shared();
+    }
+
+    void unlock_shared()
+    {
+        this->m_mutex.unlock_shared();
+    }
+};
+
+//! Scoped exclusive lock that attributes the acquisition to a call site.
+//! e.g. TimedLockGuard11<TimedMutex11> guard(mutex, PERFORMANCETIMER11_LOCK_SITE("flush"));
+template <class TimedLock>
+class TimedLockGuard11
+{
+public:
+    TimedLockGuard11(TimedLock& lock, LockSite11& site)
+        : m_lock(lock)
+    {
+        m_lock.lock(site);
+    }
+
+    ~TimedLockGuard11()
+    {
+        m_lock.unlock();
+    }
+
+    TimedLockGuard11(const TimedLockGuard11&) = delete;
+    TimedLockGuard11& operator=(const TimedLockGuard11&) = delete;
+
+private:
+    TimedLock& m_lock;
+};
+
+using TimedMutex11    = TimedLock11<std::mutex>;
+using TimedSpinLock11 = TimedLock11<SpinLock11>;
+#if defined(PERFORMANCETIMER11_HAS_SHARED_MUTEX)
+using TimedSharedMutex11 = TimedSharedLock11<std::shared_mutex>;
+#endif
@@ -0,0 +1,454 @@
+// ==================================================================
+// BSD 3-Clause License
+//
+// Copyright (c) 2017-2020, Alexander K. Freed
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// ==================================================================
+
+
+// Language: ISO C++11
+
+// Measures how much time each core loses to interrupts, SMIs and other work the kernel
+// or firmware does behind user code, in the manner of the kernel's hwlat tracer: a
+// thread pinned to the core spins on the fastest clock and records every gap between
+// consecutive reads above a threshold. The spin runs in short slices; the core's
+// /proc/interrupts count and, where readable, its SMI counter (MSR 0x34 through
+// /dev/cpu/N/msr, Intel only, needs privileges) are read between slices, and a slice
+// ends at its first gap. A gap during which neither counter moved is unexplained: likely
+// an uncounted SMI or a hypervisor exit. An interrupt elsewhere in the same slice (up to
+// 100 us, or 10 thresholds) explains a gap too, so on a core with a periodic tick a few
+// unexplained gaps are missed. Use the report to pick cores for isolcpus/nohz_full.
+//
+//     NoiseDetector11 detector(10.0, 1000.0);  // 10 us threshold, 1 s per core.
+//     NoiseDetector11::Report(std::cout, detector.MeasureAll());
+//
+// Linux only. Elsewhere no cores are measured.
+
+#pragma once
+
+#include "ClockCorrelator11.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+//! The noise measured on one core.
+struct CpuNoise11
+{
+    int           cpu;
+    double        sampled;      //!< Time spent spinning, not counting the reads between slices. Unit is milliseconds.
+    double        stolen;       //!< Total length of the gaps. Unit is milliseconds.
+    double        maxGap;       //!< Unit is milliseconds.
+    std::uint64_t gaps;         //!< Number of gaps above the threshold.
+    std::uint64_t unexplained;  //!< Gaps during which no interrupt or SMI was counted on the core.
+    std::uint64_t interrupts;   //!< Interrupts delivered to the core while spinning.
+    std::int64_t  smis;         //!< SMIs while spinning, or -1 if the counter isn't readable.
+
+    //! Interrupt sources that fired on the core while spinning, most frequent first.
+    std::vector<std::pair<std::string, std::uint64_t>> sources;
+
+    //! @return The fraction of the sampled time lost to gaps.
+    double GetStolenFraction() const
+    {
+        return sampled > 0 ? stolen / sampled : 0;
+    }
+};
+
+//! Detects time stolen from user code on each core.
+class NoiseDetector11
+{
+public:
+    //! @param[in] threshold Gaps longer than this are recorded. Unit is microseconds.
+    //! @param[in] window How long to spin on each core. Unit is milliseconds.
+    explicit NoiseDetector11(double threshold = 10.0, double window = 1000.0)
+        : m_threshold(threshold)
+        , m_window(window)
+    {
+    }
+
+    //! Pin the calling thread to a core, spin for the window, and restore the thread's
+    //! affinity.
+    //! @param[in] cpu The core to measure.
+    //! @param[out] result Receives the measurement.
+    //! @return false if the thread couldn't be pinned to the core.
+    bool MeasureCpu(int cpu, CpuNoise11& result) const
+    {
+        result = CpuNoise11();
+        result.cpu = cpu;
+        result.smis = -1;
+#if defined(__linux__)
+        cpu_set_t original;
+        if (sched_getaffinity(0, sizeof(original), &original) != 0)
+            return false;
+        cpu_set_t pinned;
+        CPU_ZERO(&pinned);
+        CPU_SET(cpu, &pinned);
+        if (sched_setaffinity(0, sizeof(pinned), &pinned) != 0)
+            return false;
+
+        const int msr = OpenMsr(cpu);
+        const InterruptCounts before = ReadInterrupts(cpu);
+        const std::int64_t smisBefore = ReadSmiCount(msr);
+        Spin(cpu, msr, result);
+        const std::int64_t smisAfter = ReadSmiCount(msr);
+        const InterruptCounts after = ReadInterrupts(cpu);
+        if (msr >= 0)
+            close(msr);
+
+        if (smisBefore >= 0 && smisAfter >= 0)
+            result.smis = smisAfter - smisBefore;
+        for (const auto& source : after)
+        {
+            std::uint64_t previous = 0;
+            for (const auto& old : before)
+            {
+                if (old.first == source.first)
+                    previous = old.second;
+            }
+            if (source.second > previous)
+            {
+                result.interrupts += source.second - previous;
+                result.sources.push_back(std::make_pair(source.first, source.second - previous));
+            }
+        }
+        std::sort(result.sources.begin(), result.sources.end(),
+            [](const std::pair<std::string, std::uint64_t>& a, const std::pair<std::string, std::uint64_t>& b) {
+                return a.second > b.second;
+            });
+
+        sched_setaffinity(0, sizeof(original), &original);
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    //! Measure every core the calling thread may run on, one after another.
+    //! @return One entry per measured core.
+    std::vector<CpuNoise11> MeasureAll() const
+    {
+        std::vector<CpuNoise11> results;
+#if defined(__linux__)
+        cpu_set_t allowed;
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+            return results;
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+        {
+            CpuNoise11 result;
+            if (CPU_ISSET(cpu, &allowed) && MeasureCpu(cpu, result))
+                results.push_back(result);
+        }
+#endif
+        return results;
+    }
+
+    //! Write one line per core with the stolen time, gaps and interrupt counts, followed
+    //! by the top interrupt sources of the core.
+    static void Report(std::ostream& os, const std::vector<CpuNoise11>& results)
+    {
+        os << std::fixed;
+        for (const CpuNoise11& result : results)
+        {
+            os << "cpu" << std::left << std::setw(4) << result.cpu << std::right
+               << " stolen " << std::setprecision(3) << result.stolen << " ms ("
+               << std::setprecision(4) << 100.0 * result.GetStolenFraction() << "%)"
+               << ", gaps " << result.gaps
+               << ", max " << std::setprecision(3) << result.maxGap * 1000.0 << " us"
+               << ", interrupts " << result.interrupts;
+            if (result.smis >= 0)
+                os << ", smis " << result.smis;
+            os << ", unexplained " << result.unexplained << "\n";
+            for (std::size_t i = 0; i < result.sources.size() && i < 5; ++i)
+                os << "        " << std::setw(8) << result.sources[i].second << "  " << result.sources[i].first << "\n";
+        }
+    }
+
+private:
+    using InterruptCounts = std::vector<std::pair<std::string, std::uint64_t>>;
+
+    // The interrupt and SMI counts of a core, read between slices of the spin.
+    struct SliceCounts
+    {
+        std::uint64_t interrupts;
+        std::int64_t  smis;
+
+        bool operator==(const SliceCounts& other) const
+        {
+            return interrupts == other.interrupts && smis == other.smis;
+        }
+    };
+
+    void Spin(int cpu, int msr, CpuNoise11& result) const
+    {
+        // Calibrate the fast clock against the monotonic clock so the loop itself only
+        // reads the fast clock.
+        const std::int64_t calibrationFast = ClockCorrelator11::ReadFast();
+        const std::int64_t calibrationMonotonic = ClockCorrelator11::Monotonic();
+        while (ClockCorrelator11::Monotonic() - calibrationMonotonic < 10000000)
+        {
+        }
+        const double fastPerNanosecond = static_cast<double>(ClockCorrelator11::ReadFast() - calibrationFast)
+            / static_cast<double>(ClockCorrelator11::Monotonic() - calibrationMonotonic);
+
+        const std::int64_t threshold = static_cast<std::int64_t>(m_threshold * 1000.0 * fastPerNanosecond);
+        const std::int64_t window = static_cast<std::int64_t>(m_window * 1000000.0 * fastPerNanosecond);
+        const std::int64_t slice = std::max(10 * threshold, static_cast<std::int64_t>(100000.0 * fastPerNanosecond));
+        std::string text;
+        SliceCounts counts;
+        bool counted = ReadSliceCounts(cpu, msr, text, counts);
+        std::int64_t spun = 0;
+        std::int64_t stolen = 0;
+        std::int64_t maxGap = 0;
+        std::uint64_t gaps = 0;
+        std::uint64_t unexplained = 0;
+        while (spun < window)
+        {
+            const std::int64_t start = ClockCorrelator11::ReadFast();
+            const std::int64_t end = start + std::min(slice, window - spun);
+            std::int64_t last = start;
+            bool gapFound = false;
+            while (last < end && !gapFound)
+            {
+                const std::int64_t now = ClockCorrelator11::ReadFast();
+                const std::int64_t gap = now - last;
+                if (gap > threshold)
+                {
+                    ++gaps;
+                    stolen += gap;
+                    maxGap = std::max(maxGap, gap);
+                    gapFound = true;
+                }
+                last = now;
+            }
+            spun += last - start;
+
+            const SliceCounts previous = counts;
+            const bool wasCounted = counted;
+            counted = ReadSliceCounts(cpu, msr, text, counts);
+            if (gapFound && wasCounted && counted && counts == previous)
+                ++unexplained;
+        }
+
+        const double millisecondsPerFast = 1.0 / (fastPerNanosecond * 1000000.0);
+        result.sampled = static_cast<double>(spun) * millisecondsPerFast;
+        result.stolen = static_cast<double>(stolen) * millisecondsPerFast;
+        result.maxGap = static_cast<double>(maxGap) * millisecondsPerFast;
+        result.gaps = gaps;
+        result.unexplained = unexplained;
+    }
+
+    static bool ReadSliceCounts(int cpu, int msr, std::string& text, SliceCounts& counts)
+    {
+        counts.smis = ReadSmiCount(msr);
+        return ReadInterruptTotal(cpu, text, counts.interrupts);
+    }
+
+    // The sum of the core's column of /proc/interrupts. Called between slices of the
+    // spin, so it parses in place instead of with streams; text keeps its capacity.
+    static bool ReadInterruptTotal(int cpu, std::string& text, std::uint64_t& total)
+    {
+#if defined(__linux__)
+        const int fd = open("/proc/interrupts", O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return false;
+        text.clear();
+        char chunk[4096];
+        ssize_t size;
+        while ((size = read(fd, chunk, sizeof(chunk))) > 0)
+            text.append(chunk, static_cast<std::size_t>(size));
+        close(fd);
+
+        char name[32];
+        std::snprintf(name, sizeof(name), "CPU%d", cpu);
+        const std::size_t nameLength = std::strlen(name);
+        const char* p = text.c_str();
+        const char* lineEnd = std::strchr(p, '\n');
+        if (lineEnd == nullptr)
+            return false;
+        std::size_t columns = 0;
+        std::size_t column = static_cast<std::size_t>(-1);
+        while (p < lineEnd)
+        {
+            while (p < lineEnd && *p == ' ')
+                ++p;
+            const char* word = p;
+            while (p < lineEnd && *p != ' ')
+                ++p;
+            if (p == word)
+                break;
+            if (static_cast<std::size_t>(p - word) == nameLength && std::strncmp(word, name, nameLength) == 0)
+                column = columns;
+            ++columns;
+        }
+        if (column == static_cast<std::size_t>(-1))
+            return false;
+
+        // Only lines with a count for every CPU; ERR and MIS are system-wide.
+        total = 0;
+        while (*lineEnd == '\n')
+        {
+            p = lineEnd + 1;
+            lineEnd = std::strchr(p, '\n');
+            if (lineEnd == nullptr)
+                lineEnd = p + std::strlen(p);
+            const char* colon = static_cast<const char*>(std::memchr(p, ':', static_cast<std::size_t>(lineEnd - p)));
+            if (colon == nullptr)
+                continue;
+            p = colon + 1;
+            std::uint64_t value = 0;
+            std::size_t index = 0;
+            for (; index < columns; ++index)
+            {
+                char* end = nullptr;
+                const unsigned long long count = std::strtoull(p, &end, 10);
+                if (end == p || end > lineEnd)
+                    break;
+                if (index == column)
+                    value = count;
+                p = end;
+            }
+            if (index == columns)
+                total += value;
+        }
+        return true;
+#else
+        (void)cpu;
+        (void)text;
+        (void)total;
+        return false;
+#endif
+    }
+
+    // The header of /proc/interrupts names the online CPUs; each following line has a
+    // label, one count per online CPU (or a single count for ERR and MIS), and for
+    // numbered interrupts a description, which is appended to the label.
+    static InterruptCounts ReadInterrupts(int cpu)
+    {
+        InterruptCounts counts;
+        std::ifstream file("/proc/interrupts");
+        std::string line;
+        if (!std::getline(file, line))
+            return counts;
+
+        std::istringstream header(line);
+        std::string name;
+        std::size_t columns = 0;
+        std::size_t column = static_cast<std::size_t>(-1);
+        while (header >> name)
+        {
+            if (name == "CPU" + std::to_string(cpu))
+                column = columns;
+            ++columns;
+        }
+        if (column == static_cast<std::size_t>(-1))
+            return counts;
+
+        while (std::getline(file, line))
+        {
+            std::istringstream fields(line);
+            std::string label;
+            if (!(fields >> label) || label.back() != ':')
+                continue;
+            label.pop_back();
+            std::uint64_t value = 0;
+            std::size_t index = 0;
+            std::string token;
+            bool found = false;
+            for (; index < columns && fields >> token; ++index)
+            {
+                if (token.find_first_not_of("0123456789") != std::string::npos)
+                    break;
+                if (index == column)
+                {
+                    value = std::stoull(token);
+                    found = true;
+                }
+            }
+            if (!found)
+                continue;
+            if (label.find_first_not_of("0123456789") == std::string::npos)
+            {
+                std::string description;
+                std::getline(fields, description);
+                std::istringstream words(description);
+                std::string word;
+                while (words >> word)
+                    label += " " + word;
+            }
+            counts.push_back(std::make_pair(label, value));
+        }
+        return counts;
+    }
+
+    //! @return The core's MSR device, or -1 if it can't be opened.
+    static int OpenMsr(int cpu)
+    {
+#if defined(__linux__)
+        const std::string path = "/dev/cpu/" + std::to_string(cpu) + "/msr";
+        return open(path.c_str(), O_RDONLY | O_CLOEXEC);
+#else
+        (void)cpu;
+        return -1;
+#endif
+    }
+
+    //! @return The SMI count from the MSR device, or -1 if it isn't readable.
+    static std::int64_t ReadSmiCount(int msr)
+    {
+#if defined(__linux__)
+        if (msr < 0)
+            return -1;
+        std::uint64_t value = 0;
+        if (pread(msr, &value, sizeof(value), 0x34) != static_cast<ssize_t>(sizeof(value)))
+            return -1;
+        return static_cast<std::int64_t>(value & 0xFFFFFFFF);
+#else
+        (void)msr;
+        return -1;
+#endif
+    }
+
+    double m_threshold;     // Unit is microseconds.
+    double m_window;        // Unit is milliseconds.
+};
@@ -40,12 +40,23 @@
 #include <chrono>
 #include <type_traits>
 
+#if defined(PERFORMANCETIMER11_USE_VDSO)
+#include "VdsoClock11.hpp"
+#endif
+
 //! A C++11 standard high-performance timer that can be used for accurately
 //! tracking run time or controlling game loops.
 class PerformanceTimer11
 {
+public:
+#if defined(PERFORMANCETIMER11_USE_VDSO)
+    using Clock = VdsoClock11;
+#else
     using Clock = typename std::conditional<std::chrono::high_resolution_clock::is_steady,
         std::chrono::high_resolution_clock, std::chrono::steady_clock>::type;
+#endif
+
+private:
     using Seconds      = std::chrono::duration<double>;
     using Milliseconds = std::chrono::duration<double, std::milli>;
 
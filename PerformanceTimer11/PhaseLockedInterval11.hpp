@@ -0,0 +1,250 @@
+// ==================================================================
+// BSD 3-Clause License
+//
+// Copyright (c) 2017-2020, Alexander K. Freed
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// ==================================================================
+
+
+// Language: ISO C++11
+
+#pragma once
+
+#include "TickClock11.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+
+#if defined(__linux__)
+#include <time.h>
+#endif
+
+//! An interval scheduler whose ticks land on multiples of the interval on a reference
+//! clock (e.g. on wall-clock second boundaries), so that loops on several hosts stay
+//! in phase.
+//!
+//! Deadlines are scheduled on the PerformanceTimer11 clock, which is steady. After each
+//! tick, the phase error against the reference is measured and a PI controller (a
+//! software PLL) adjusts the length of the following intervals. Corrections are slewed:
+//! each interval differs from the nominal one by at most the slew limit, so the loop
+//! never jumps, even if the reference clock is stepped.
+//!
+//! Use it like the PerformanceTimer11 game loop:
+//!     PhaseLockedInterval11 interval(100);  // 100 Hz, aligned to CLOCK_REALTIME.
+//!     interval.Start();
+//!     while (true)
+//!     {
+//!         // ACQUISITION CODE.
+//!         while (!interval.IntervalHasElapsed())
+//!             if (interval.GetRemaining() > 1) std::this_thread::yield();
+//!         interval.Advance();
+//!     }
+class PhaseLockedInterval11
+{
+public:
+    //! The reference clocks.
+    enum Reference
+    {
+        Realtime,  //!< CLOCK_REALTIME (std::chrono::system_clock elsewhere).
+        Tai        //!< CLOCK_TAI on Linux: like Realtime, but without leap seconds.
+    };
+
+    //! @param[in] ticksPerSecond The number of intervals per second. e.g. 100 for every 10 ms.
+    //!            The interval is rounded to whole nanoseconds.
+    //! @param[in] reference The clock the ticks are aligned to.
+    //! @param[in] epoch The reference time of tick 0 in nanoseconds. Ticks land on epoch + k * interval.
+    explicit PhaseLockedInterval11(double ticksPerSecond, Reference reference = Realtime, std::int64_t epoch = 0)
+        : m_reference(reference)
+        , m_epoch(epoch)
+        , m_intervalNs(std::max<std::int64_t>(static_cast<std::int64_t>(1e9 / ticksPerSecond + 0.5), 1))
+        , m_intervalTicks(static_cast<double>(m_intervalNs) * TickClock11::TicksPerSecond() / 1e9)
+        , m_proportionalGain(0.1)
+        , m_integralGain(0.01)
+        , m_maxSlew(500e-6)
+        , m_frequency(0)
+        , m_phaseError(0)
+        , m_index(0)
+        , m_startTicks(0)
+        , m_deadline(0)
+        , m_deadlineTicks(0)
+        , m_missed(0)
+    {
+        assert(ticksPerSecond > 0);
+    }
+
+    //! Set the PI controller gains, per tick. Higher gains lock faster but pass more of
+    //! the reference's noise into the loop. Default is 0.1 and 0.01.
+    void SetGains(double proportional, double integral)
+    {
+        m_proportionalGain = proportional;
+        m_integralGain = integral;
+    }
+
+    //! Set the largest correction of an interval, as a fraction of it. Default is 500e-6 (500 ppm).
+    void SetMaxSlew(double fraction)
+    {
+        m_maxSlew = fraction;
+    }
+
+    //! Schedule the first tick on the next interval boundary of the reference clock.
+    void Start()
+    {
+        TickClock11::Ticks now;
+        const std::int64_t reference = ReadReference(now);
+        const std::int64_t offset = reference - m_epoch;
+        m_index = offset / m_intervalNs;
+        if (m_index * m_intervalNs < offset)
+            ++m_index;
+        m_startTicks = now;
+        m_deadline = ToTicks(Ideal(m_index) - reference);
+        m_deadlineTicks = m_startTicks + static_cast<TickClock11::Ticks>(m_deadline);
+        m_frequency = 0;
+        m_phaseError = 0;
+        m_missed = 0;
+    }
+
+    //! @return true if the current tick's deadline has passed.
+    bool IntervalHasElapsed() const
+    {
+        return TickClock11::Now() >= m_deadlineTicks;
+    }
+
+    //! @return The time until the current tick's deadline in milliseconds.
+    double GetRemaining() const
+    {
+        return TickClock11::ToMilliseconds(m_deadlineTicks - TickClock11::Now());
+    }
+
+    //! Measure the phase error of the tick that just elapsed, update the controller and
+    //! schedule the next tick. Ticks that were overrun completely are skipped.
+    void Advance()
+    {
+        TickClock11::Ticks now;
+        const std::int64_t reference = ReadReference(now);
+
+        // Where the deadline fell on the reference clock, compared to where it should have.
+        // Only the differences are converted to double: at reference clock magnitudes
+        // a double resolves just 256 ns.
+        const double elapsed = static_cast<double>(now - m_startTicks);
+        const double lateness = (elapsed - m_deadline) * static_cast<double>(m_intervalNs) / m_intervalTicks;
+        double error = (static_cast<double>(reference - Ideal(m_index)) - lateness) / static_cast<double>(m_intervalNs);
+        error -= std::floor(error + 0.5);  // The nearest boundary, in case the loop slipped a whole interval.
+        m_phaseError = error;
+
+        // PI controller. Positive error means late: shorten the next interval.
+        m_frequency = Clamp(m_frequency + m_integralGain * error);
+        const double correction = Clamp(m_frequency + m_proportionalGain * error);
+        m_deadline += m_intervalTicks * (1 - correction);
+        ++m_index;
+
+        while (m_deadline <= elapsed)
+        {
+            m_deadline += m_intervalTicks * (1 - m_frequency);
+            ++m_index;
+            ++m_missed;
+        }
+        m_deadlineTicks = m_startTicks + static_cast<TickClock11::Ticks>(m_deadline);
+    }
+
+    //! @return The phase error measured at the last tick in milliseconds. Positive is late.
+    double GetPhaseError() const
+    {
+        return m_phaseError * static_cast<double>(m_intervalNs) / 1e6;
+    }
+
+    //! @return The current frequency correction in parts per million.
+    double GetFrequencyCorrection() const
+    {
+        return m_frequency * 1e6;
+    }
+
+    //! @return The number of ticks skipped because the loop overran them.
+    std::int64_t GetMissedTicks() const
+    {
+        return m_missed;
+    }
+
+    //! @return The index k of the current tick (its ideal time is epoch + k * interval).
+    std::int64_t GetTickIndex() const
+    {
+        return m_index;
+    }
+
+private:
+    std::int64_t Ideal(std::int64_t index) const
+    {
+        return m_epoch + index * m_intervalNs;
+    }
+
+    // Converts a (small) reference clock difference to local ticks.
+    double ToTicks(std::int64_t nanoseconds) const
+    {
+        return static_cast<double>(nanoseconds) * m_intervalTicks / static_cast<double>(m_intervalNs);
+    }
+
+    double Clamp(double fraction) const
+    {
+        return std::min(std::max(fraction, -m_maxSlew), m_maxSlew);
+    }
+
+    // Reads the reference between two local reads, and returns the local time of the midpoint.
+    std::int64_t ReadReference(TickClock11::Ticks& now) const
+    {
+        const TickClock11::Ticks before = TickClock11::Now();
+        std::int64_t reference;
+#if defined(__linux__)
+        timespec ts;
+        clock_gettime(m_reference == Tai ? CLOCK_TAI : CLOCK_REALTIME, &ts);
+        reference = static_cast<std::int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+#else
+        reference = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+#endif
+        const TickClock11::Ticks after = TickClock11::Now();
+        now = before + (after - before) / 2;
+        return reference;
+    }
+
+    Reference          m_reference;
+    std::int64_t       m_epoch;
+    std::int64_t       m_intervalNs;
+    double             m_intervalTicks;
+    double             m_proportionalGain;
+    double             m_integralGain;
+    double             m_maxSlew;
+    double             m_frequency;   // Integral term, as a fraction of the interval.
+    double             m_phaseError;  // Last error, as a fraction of the interval.
+    std::int64_t       m_index;
+    TickClock11::Ticks m_startTicks;  // The local time of Start().
+    double             m_deadline;    // Local ticks since Start(), with the fraction kept.
+    TickClock11::Ticks m_deadlineTicks;
+    std::int64_t       m_missed;
+};
@@ -0,0 +1,232 @@
+// ==================================================================
+// BSD 3-Clause License
+//
+// Copyright (c) 2017-2020, Alexander K. Freed
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// ==================================================================
+
+
+// Language: ISO C++11
+
+// Zones that are compiled in but off until enabled at run time. Each probe belongs to
+// one of 64 categories, and a disabled probe costs one load of a read-mostly mask and a
+// branch predicted not taken: no clock read, no registration, no zone stack push.
+//
+//     ProbeCategories11::SetName(3, "network");
+//
+//     void Send()
+//     {
+//         PERFORMANCETIMER11_PROBE(3, "send");
+//         // CODE TO MEASURE, when "network" is enabled.
+//     }
+//
+//     ProbeCategories11::Configure("network,-render");  // Any time, from any thread.
+//
+// Probes that are inside their scope when a category changes finish as they began.
+
+#pragma once
+
+#include "TimerRegistry11.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <string>
+
+#if defined(__GNUC__)
+#define PERFORMANCETIMER11_UNLIKELY(condition) __builtin_expect(!!(condition), 0)
+#else
+#define PERFORMANCETIMER11_UNLIKELY(condition) (condition)
+#endif
+
+//! The set of enabled probe categories.
+class ProbeCategories11
+{
+public:
+    static const std::uint32_t MaxCategories = 64;
+
+    //! @return true if probes of the category are enabled. Always false for categories
+    //!         of MaxCategories and above.
+    static bool IsEnabled(std::uint32_t category)
+    {
+        return category < MaxCategories && ((State().mask.load(std::memory_order_relaxed) >> category) & 1);
+    }
+
+    //! @return The mask of enabled categories, one bit per category.
+    static std::uint64_t GetMask()
+    {
+        return State().mask.load(std::memory_order_relaxed);
+    }
+
+    //! Enable exactly the categories whose bits are set.
+    static void SetMask(std::uint64_t mask)
+    {
+        State().mask.store(mask, std::memory_order_relaxed);
+    }
+
+    //! Enable or disable one category. Categories of MaxCategories and above are ignored.
+    static void Enable(std::uint32_t category)
+    {
+        if (category < MaxCategories)
+            State().mask.fetch_or(std::uint64_t(1) << category, std::memory_order_relaxed);
+    }
+
+    static void Disable(std::uint32_t category)
+    {
+        if (category < MaxCategories)
+            State().mask.fetch_and(~(std::uint64_t(1) << category), std::memory_order_relaxed);
+    }
+
+    //! Give a category a name for Configure().
+    //! @param[in] name Must outlive its use (e.g. a string literal).
+    static void SetName(std::uint32_t category, const char* name)
+    {
+        if (category < MaxCategories)
+            State().names[category].store(name, std::memory_order_release);
+    }
+
+    //! @return The name of a category, or nullptr if it has none.
+    static const char* GetName(std::uint32_t category)
+    {
+        return category < MaxCategories ? State().names[category].load(std::memory_order_acquire) : nullptr;
+    }
+
+    //! Change the enabled categories from a comma-separated list, applied left to
+    //! right. Each item is a category name or number to enable, the same prefixed with
+    //! '-' to disable, "all", or "none". e.g. "none,network,3" or "all,-render".
+    //! Suited to an environment variable or an admin command.
+    //! A null spec is treated as empty, so Configure(std::getenv(...)) is safe.
+    //! @return false if an item wasn't recognized. The other items are still applied.
+    static bool Configure(const char* spec)
+    {
+        if (spec == nullptr)
+            return true;
+        std::uint64_t mask = GetMask();
+        bool ok = true;
+        std::string items(spec);
+        std::size_t begin = 0;
+        while (begin <= items.size())
+        {
+            std::size_t end = items.find(',', begin);
+            if (end == std::string::npos)
+                end = items.size();
+            std::string item = items.substr(begin, end - begin);
+            begin = end + 1;
+            if (item.empty())
+                continue;
+
+            const bool disable = item[0] == '-';
+            if (disable)
+                item.erase(0, 1);
+            std::uint64_t bits = 0;
+            if (item == "all")
+                bits = ~std::uint64_t(0);
+            else if (item == "none")
+                mask = 0;
+            else if (!Lookup(item, bits))
+                ok = false;
+            mask = disable ? mask & ~bits : mask | bits;
+        }
+        SetMask(mask);
+        return ok;
+    }
+
+private:
+    // The mask is alone in its cache line: probes only read it, so it stays shared in
+    // every core's cache until a category changes.
+    struct Shared
+    {
+        alignas(64) std::atomic<std::uint64_t> mask;
+        alignas(64) std::atomic<const char*>   names[MaxCategories];
+    };
+
+    static Shared& State()
+    {
+        static Shared state;
+        return state;
+    }
+
+    static bool Lookup(const std::string& item, std::uint64_t& bits)
+    {
+        for (std::uint32_t category = 0; category < MaxCategories; ++category)
+        {
+            const char* name = GetName(category);
+            if (name != nullptr && item == name)
+            {
+                bits = std::uint64_t(1) << category;
+                return true;
+            }
+        }
+        char* end = nullptr;
+        const unsigned long category = std::strtoul(item.c_str(), &end, 10);
+        if (end == item.c_str() || *end != '\0' || category >= MaxCategories)
+            return false;
+        bits = std::uint64_t(1) << category;
+        return true;
+    }
+};
+
+//! A ZoneTimer11 that only runs when its category is enabled.
+class ProbeZone11
+{
+public:
+    ProbeZone11(TimerSite11& site, std::uint32_t category)
+        : m_active(false)
+    {
+        if (PERFORMANCETIMER11_UNLIKELY(ProbeCategories11::IsEnabled(category)))
+        {
+            new (m_zone) ZoneTimer11(site);
+            m_active = true;
+        }
+    }
+
+    ~ProbeZone11()
+    {
+        if (PERFORMANCETIMER11_UNLIKELY(m_active))
+            reinterpret_cast<ZoneTimer11*>(m_zone)->~ZoneTimer11();
+    }
+
+    ProbeZone11(const ProbeZone11&) = delete;
+    ProbeZone11& operator=(const ProbeZone11&) = delete;
+
+    //! @return true if the probe is measuring.
+    bool IsActive() const { return m_active; }
+
+private:
+    alignas(ZoneTimer11) unsigned char m_zone[sizeof(ZoneTimer11)];
+    bool m_active;
+};
+
+//! Measure the rest of the enclosing scope as a zone with the given name, when the
+//! probe category is enabled. The category must be a constant from 0 to 63; for a
+//! category chosen at run time, use ProbeZone11 directly.
+#define PERFORMANCETIMER11_PROBE(category, name) \
+    static_assert((category) < ProbeCategories11::MaxCategories, "probe category out of range"); \
+    PERFORMANCETIMER11_SITE(PERFORMANCETIMER11_CONCAT(performanceTimer11Site, __LINE__), name); \
+    ProbeZone11 PERFORMANCETIMER11_CONCAT(performanceTimer11Probe, __LINE__)(PERFORMANCETIMER11_CONCAT(performanceTimer11Site, __LINE__), (category))
@@ -0,0 +1,211 @@
+// ==================================================================
+// BSD 3-Clause License
+//
+// Copyright (c) 2017-2020, Alexander K. Freed
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// ==================================================================
+
+
+// Language: ISO C++11
+
+// Lock-free rate limiters that work on raw ticks of the PerformanceTimer11 clock.
+// Each keeps its whole state in one atomic timestamp, so acquiring is a load, some
+// integer arithmetic and (only when permitted) one compare-and-swap. Denied requests
+// never write, so a saturated limiter doesn't bounce its cache line between threads.
+//
+// Every function takes the current time as an optional argument, so a caller that
+// already read the clock (e.g. once per batch of requests) can pass it in.
+
+#pragma once
+
+#include "TickClock11.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+
+//! A token bucket. Tokens accumulate at a fixed rate up to the capacity, which is
+//! the largest burst allowed.
+class TokenBucket11
+{
+public:
+    using Ticks = TickClock11::Ticks;
+
+    //! The bucket starts full.
+    //! @param[in] tokensPerSecond The refill rate. Must be lower than the clock's tick rate.
+    //! @param[in] capacity The maximum number of tokens (the burst size).
+    TokenBucket11(double tokensPerSecond, std::int64_t capacity)
+        : m_ticksPerToken(std::max<Ticks>(1, static_cast<Ticks>(TickClock11::TicksPerSecond() / tokensPerSecond)))
+        , m_capacityTicks(capacity * m_ticksPerToken)
+        , m_emptyAt(TickClock11::Now() - m_capacityTicks)
+    {
+        assert(tokensPerSecond > 0 && capacity > 0);
+    }
+
+    TokenBucket11(const TokenBucket11&) = delete;
+    TokenBucket11& operator=(const TokenBucket11&) = delete;
+
+    //! Take tokens if they are all available.
+    //! @param[in] tokens The number of tokens to take. More than the capacity can never
+    //!            be available at once, so such requests always fail; use AcquireUpTo().
+    //! @param[in] now The current time in ticks.
+    //! @return true if the tokens were taken.
+    bool TryAcquire(std::int64_t tokens = 1, Ticks now = TickClock11::Now())
+    {
+        if (tokens > GetCapacity())
+            return false;
+        const Ticks cost = tokens * m_ticksPerToken;
+        Ticks emptyAt = m_emptyAt.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            const Ticks next = std::max(emptyAt, now - m_capacityTicks) + cost;
+            if (next > now)
+                return false;
+            if (m_emptyAt.compare_exchange_weak(emptyAt, next, std::memory_order_relaxed))
+                return true;
+        }
+    }
+
+    //! Take as many tokens as are available, up to a maximum.
+    //! @param[in] tokens The maximum number of tokens to take.
+    //! @param[in] now The current time in ticks.
+    //! @return The number of tokens taken.
+    std::int64_t AcquireUpTo(std::int64_t tokens, Ticks now = TickClock11::Now())
+    {
+        Ticks emptyAt = m_emptyAt.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            const Ticks base = std::max(emptyAt, now - m_capacityTicks);
+            const std::int64_t taken = std::min(tokens, (now - base) / m_ticksPerToken);
+            if (taken <= 0)
+                return 0;
+            if (m_emptyAt.compare_exchange_weak(emptyAt, base + taken * m_ticksPerToken, std::memory_order_relaxed))
+                return taken;
+        }
+    }
+
+    //! @param[in] now The current time in ticks.
+    //! @return The number of tokens available.
+    std::int64_t GetAvailable(Ticks now = TickClock11::Now()) const
+    {
+        const Ticks base = std::max(m_emptyAt.load(std::memory_order_relaxed), now - m_capacityTicks);
+        return std::max<Ticks>(0, (now - base) / m_ticksPerToken);
+    }
+
+    //! @return The capacity (burst size) in tokens.
+    std::int64_t GetCapacity() const
+    {
+        return m_capacityTicks / m_ticksPerToken;
+    }
+
+private:
+    const Ticks m_ticksPerToken;
+    const Ticks m_capacityTicks;
+
+    // The time at which the bucket was (or will be) empty. The number of tokens is the
+    // time since then divided by m_ticksPerToken, capped at the capacity.
+    alignas(64) std::atomic<Ticks> m_emptyAt;
+};
+
+//! A rate limiter using the Generic Cell Rate Algorithm. It allows the same traffic
+//! as a token bucket, but tracks the theoretical arrival time (TAT) of the next request,
+//! which makes it cheap to tell a denied caller how long to wait.
+class Gcra11
+{
+public:
+    using Ticks = TickClock11::Ticks;
+
+    //! The retry time of a batch that can never conform because it is larger than the burst.
+    static const Ticks Never = INT64_MAX;
+
+    //! @param[in] requestsPerSecond The sustained rate. Must be lower than the clock's tick rate.
+    //! @param[in] burst The number of requests allowed at once after an idle period.
+    Gcra11(double requestsPerSecond, std::int64_t burst)
+        : m_emissionInterval(std::max<Ticks>(1, static_cast<Ticks>(TickClock11::TicksPerSecond() / requestsPerSecond)))
+        , m_burstTicks(burst * m_emissionInterval)
+        , m_tat(0)
+    {
+        assert(requestsPerSecond > 0 && burst > 0);
+    }
+
+    Gcra11(const Gcra11&) = delete;
+    Gcra11& operator=(const Gcra11&) = delete;
+
+    //! Admit a batch of requests if they all conform.
+    //! @param[in] requests The number of requests. A batch larger than the burst never
+    //!            conforms: it is denied with retryAfter set to Never, so split it.
+    //! @param[in] now The current time in ticks.
+    //! @param[out] retryAfter If not null and the batch was denied, the ticks until it would conform.
+    //! @return true if the requests were admitted.
+    bool TryAcquire(std::int64_t requests = 1, Ticks now = TickClock11::Now(), Ticks* retryAfter = nullptr)
+    {
+        if (requests > GetBurst())
+        {
+            if (retryAfter != nullptr)
+                *retryAfter = Never;
+            return false;
+        }
+        const Ticks increment = requests * m_emissionInterval;
+        Ticks tat = m_tat.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            const Ticks next = std::max(tat, now) + increment;
+            // Conforming if the new TAT is no more than one burst ahead of now.
+            const Ticks wait = next - m_burstTicks - now;
+            if (wait > 0)
+            {
+                if (retryAfter != nullptr)
+                    *retryAfter = wait;
+                return false;
+            }
+            if (m_tat.compare_exchange_weak(tat, next, std::memory_order_relaxed))
+                return true;
+        }
+    }
+
+    //! @param[in] now The current time in ticks.
+    //! @return The ticks until a single request would conform. 0 if it would now.
+    Ticks GetRetryAfter(Ticks now = TickClock11::Now()) const
+    {
+        const Ticks wait = std::max(m_tat.load(std::memory_order_relaxed), now) + m_emissionInterval - m_burstTicks - now;
+        return std::max<Ticks>(0, wait);
+    }
+
+    //! @return The burst size in requests, the largest batch that can conform.
+    std::int64_t GetBurst() const
+    {
+        return m_burstTicks / m_emissionInterval;
+    }
+
+private:
+    const Ticks m_emissionInterval;
+    const Ticks m_burstTicks;
+
+    alignas(64) std::atomic<Ticks> m_tat;
+};
@@ -0,0 +1,447 @@
+// ==================================================================
+// BSD 3-Clause License
+//
+// Copyright (c) 2017-2020, Alexander K. Freed
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// ==================================================================
+
+
+// Language: ISO C++11
+
+// A sampling profiler for the code between (and inside) zones. Each registered thread
+// gets a timer on its own CPU-time clock (timer_create(CLOCK_THREAD_CPUTIME_ID)) that
+// sends SIGPROF to that thread (SIGEV_THREAD_ID), so samples are proportional to the
+// CPU time each thread actually uses. The handler walks the frame pointers into the
+// thread's lock-free ring, tagged with the thread's innermost zone (see ZoneStack11.hpp).
+// Symbols are only looked up at export.
+//
+//     SamplingProfiler11& profiler = SamplingProfiler11::Get();
+//     profiler.Start(1000);                       // Hz of CPU time per thread.
+//
+//     // On every thread to profile:
+//     ProfiledThread11 profiled;
+//
+//     // Periodically, on any thread:
+//     profiler.WriteFolded(file);                 // Input for flamegraph.pl.
+//
+// The stack walk needs frame pointers: build with -fno-omit-frame-pointer. As with
+// perf's frame-pointer unwinding, a sample in a leaf function that sets up no frame
+// misses that function's caller. Functions are named with dladdr, which only sees
+// exported symbols: link executables with -rdynamic. With CMake, link the
+// PerformanceTimer11SamplingProfiler target, which adds librt and libdl. A sample costs
+// one or two microseconds, so 1 kHz costs about 0.1-0.2% and 10 kHz 1-2% of each
+// thread's CPU time. Linux only; elsewhere nothing is sampled.
+
+#pragma once
+
+#include "TimerRegistry11.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#if defined(__linux__) && (defined(__x86_64__) || defined(__aarch64__))
+#include <csignal>
+#include <ctime>
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <ucontext.h>
+#include <unistd.h>
+#define PERFORMANCETIMER11_SAMPLING_PROFILER
+// glibc before 2.26 doesn't name the SIGEV_THREAD_ID target field.
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+#endif
+
+//! One sampled stack.
+struct ProfileSample11
+{
+    static const std::uint32_t MaxFrames = 32;
+
+    const TimerSite11* zone;                //!< The innermost zone, or nullptr.
+    std::uint32_t      depth;               //!< The number of frames.
+    std::uint32_t      thread;              //!< The OS thread id.
+    std::uintptr_t     frames[MaxFrames];   //!< The interrupted pc, then return addresses.
+};
+
+//! The process-wide sampling profiler.
+class SamplingProfiler11
+{
+public:
+    //! The number of samples each thread's ring holds until drained.
+    static const std::uint32_t RingSize = 512;
+
+    //! @return The profiler of the process.
+    static SamplingProfiler11& Get()
+    {
+        static SamplingProfiler11* profiler = new SamplingProfiler11();  // Never destroyed; handlers may still run at exit.
+        return *profiler;
+    }
+
+    SamplingProfiler11(const SamplingProfiler11&) = delete;
+    SamplingProfiler11& operator=(const SamplingProfiler11&) = delete;
+
+    //! Start sampling all registered threads, and threads registered from now on.
+    //! @param[in] frequency Samples per second of each thread's CPU time, 1 to 10000.
+    //! @return false if profiling isn't supported or the signal handler couldn't be installed.
+    bool Start(double frequency)
+    {
+#if defined(PERFORMANCETIMER11_SAMPLING_PROFILER)
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!InstallHandler())
+            return false;
+        m_interval = static_cast<long>(1e9 / std::min(std::max(frequency, 1.0), 10000.0));
+        m_running = true;
+        for (const std::unique_ptr<Ring>& ring : m_rings)
+        {
+            if (ring->registered)
+                Arm(*ring, m_interval);
+        }
+        return true;
+#else
+        (void)frequency;
+        return false;
+#endif
+    }
+
+    //! Stop sampling. Samples already taken can still be exported.
+    void Stop()
+    {
+#if defined(PERFORMANCETIMER11_SAMPLING_PROFILER)
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_running = false;
+        for (const std::unique_ptr<Ring>& ring : m_rings)
+        {
+            if (ring->registered)
+                Arm(*ring, 0);
+        }
+#endif
+    }
+
+    //! Profile the calling thread. Prefer ProfiledThread11.
+    //! @return false if the thread couldn't be registered.
+    bool RegisterThread()
+    {
+#if defined(PERFORMANCETIMER11_SAMPLING_PROFILER)
+        if (CurrentRing() != nullptr)
+            return true;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Ring* ring = nullptr;
+        for (const std::unique_ptr<Ring>& candidate : m_rings)
+        {
+            // Reuse a retired ring once its samples have been exported.
+            if (!candidate->registered && candidate->head.load(std::memory_order_acquire) == candidate->tail.load(std::memory_order_relaxed))
+                ring = candidate.get();
+        }
+        if (ring == nullptr)
+        {
+            m_rings.emplace_back(new Ring());
+            ring = m_rings.back().get();
+        }
+
+        ring->thread = static_cast<std::uint32_t>(syscall(SYS_gettid));
+        if (!GetStackBounds(ring->stackLow, ring->stackHigh))
+            return false;
+        sigevent event = {};
+        event.sigev_notify = SIGEV_THREAD_ID;
+        event.sigev_signo = SIGPROF;
+        event.sigev_notify_thread_id = static_cast<pid_t>(ring->thread);
+        if (timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &ring->timer) != 0)
+            return false;
+        ring->registered = true;
+        CurrentRing() = ring;
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        if (m_running)
+            Arm(*ring, m_interval);
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    //! Stop profiling the calling thread. Its remaining samples are still exported.
+    void UnregisterThread()
+    {
+#if defined(PERFORMANCETIMER11_SAMPLING_PROFILER)
+        Ring* ring = CurrentRing();
+        if (ring == nullptr)
+            return;
+        // Detach first, so a signal still in flight finds no ring.
+        CurrentRing() = nullptr;
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        timer_delete(ring->timer);
+        ring->registered = false;
+#endif
+    }
+
+    //! Take all samples taken so far, from all threads.
+    //! @param[in] function Called with each const ProfileSample11&.
+    //! @return The number of samples.
+    template <class Function>
+    std::size_t Drain(Function&& function)
+    {
+        std::size_t count = 0;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const std::unique_ptr<Ring>& ring : m_rings)
+        {
+            std::uint32_t tail = ring->tail.load(std::memory_order_relaxed);
+            const std::uint32_t head = ring->head.load(std::memory_order_acquire);
+            for (; tail != head; ++tail, ++count)
+                function(static_cast<const ProfileSample11&>(ring->samples[tail % RingSize]));
+            ring->tail.store(tail, std::memory_order_release);
+        }
+        return count;
+    }
+
+    //! @return The number of samples lost because a ring was full.
+    std::uint64_t GetDropped() const
+    {
+        std::uint64_t dropped = 0;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const std::unique_ptr<Ring>& ring : m_rings)
+            dropped += ring->dropped.load(std::memory_order_relaxed);
+        return dropped;
+    }
+
+    //! Drain the samples and write them as folded stacks, one line per distinct stack:
+    //! "zone;outermost;...;innermost count". Samples outside any zone start with "-".
+    //! @param[in] os The stream to write to.
+    void WriteFolded(std::ostream& os)
+    {
+        std::map<std::string, std::uint64_t> stacks;
+        std::map<std::uintptr_t, std::string> symbols;
+        Drain([&](const ProfileSample11& sample) {
+            std::string line = sample.zone != nullptr ? sample.zone->GetName() : "-";
+            for (std::uint32_t i = sample.depth; i-- > 0;)
+            {
+                // Return addresses point after the call; look up the call itself.
+                const std::uintptr_t address = i == 0 ? sample.frames[i] : sample.frames[i] - 1;
+                std::map<std::uintptr_t, std::string>::iterator symbol = symbols.find(address);
+                if (symbol == symbols.end())
+                    symbol = symbols.insert(std::make_pair(address, Symbolize(address))).first;
+                line += ';';
+                line += symbol->second;
+            }
+            ++stacks[line];
+        });
+        for (const std::pair<const std::string, std::uint64_t>& stack : stacks)
+            os << stack.first << ' ' << stack.second << '\n';
+    }
+
+    //! @return The function name of a code address, or "module+0xoffset" if it has no
+    //!         exported symbol.
+    static std::string Symbolize(std::uintptr_t address)
+    {
+        char buffer[32];
+        std::snprintf(buffer, sizeof(buffer), "0x%llx", static_cast<unsigned long long>(address));
+        std::string name(buffer);
+#if defined(PERFORMANCETIMER11_SAMPLING_PROFILER)
+        Dl_info info;
+        if (dladdr(reinterpret_cast<void*>(address), &info) == 0)
+            return name;
+        if (info.dli_sname != nullptr)
+        {
+            int status = 0;
+            char* demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+            name = status == 0 && demangled != nullptr ? demangled : info.dli_sname;
+            std::free(demangled);
+        }
+        else if (info.dli_fname != nullptr)
+        {
+            std::string module(info.dli_fname);
+            std::snprintf(buffer, sizeof(buffer), "+0x%llx",
+                static_cast<unsigned long long>(address - reinterpret_cast<std::uintptr_t>(info.dli_fbase)));
+            name = module.substr(module.find_last_of('/') + 1) + buffer;
+        }
+        // Folded stacks use ';' and ' ' as separators.
+        std::replace(name.begin(), name.end(), ';', ',');
+        std::replace(name.begin(), name.end(), ' ', '_');
+#endif
+        return name;
+    }
+
+private:
+    // Single producer (the owning thread's signal handler), single consumer (Drain(),
+    // under the mutex).
+    struct Ring
+    {
+        ProfileSample11             samples[RingSize];
+        std::atomic<std::uint32_t>  head;
+        std::atomic<std::uint32_t>  tail;
+        std::atomic<std::uint64_t>  dropped;
+        std::uintptr_t              stackLow;
+        std::uintptr_t              stackHigh;
+        std::uint32_t               thread;
+        bool                        registered;
+#if defined(PERFORMANCETIMER11_SAMPLING_PROFILER)
+        timer_t                     timer;
+#endif
+
+        Ring()
+            : head(0)
+            , tail(0)
+            , dropped(0)
+            , stackLow(0)
+            , stackHigh(0)
+            , thread(0)
+            , registered(false)
+        {
+        }
+    };
+
+    SamplingProfiler11()
+        : m_interval(1000000)
+        , m_running(false)
+        , m_handlerInstalled(false)
+    {
+    }
+
+    static Ring*& CurrentRing()
+    {
+        static thread_local Ring* ring = nullptr;
+        return ring;
+    }
+
+#if defined(PERFORMANCETIMER11_SAMPLING_PROFILER)
+    bool InstallHandler()
+    {
+        if (m_handlerInstalled)
+            return true;
+        struct sigaction action = {};
+        action.sa_sigaction = &Handler;
+        action.sa_flags = SA_SIGINFO | SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        m_handlerInstalled = sigaction(SIGPROF, &action, nullptr) == 0;
+        return m_handlerInstalled;
+    }
+
+    static void Arm(Ring& ring, long interval)
+    {
+        itimerspec spec = {};
+        spec.it_interval.tv_sec = interval / 1000000000;
+        spec.it_interval.tv_nsec = interval % 1000000000;
+        spec.it_value = spec.it_interval;
+        timer_settime(ring.timer, 0, &spec, nullptr);
+    }
+
+    static bool GetStackBounds(std::uintptr_t& low, std::uintptr_t& high)
+    {
+        pthread_attr_t attributes;
+        if (pthread_getattr_np(pthread_self(), &attributes) != 0)
+            return false;
+        void* address = nullptr;
+        std::size_t size = 0;
+        const bool ok = pthread_attr_getstack(&attributes, &address, &size) == 0;
+        pthread_attr_destroy(&attributes);
+        low = reinterpret_cast<std::uintptr_t>(address);
+        high = low + size;
+        return ok;
+    }
+
+    // Async-signal-safe: touches only the thread's own ring and zone stack.
+    static void Handler(int, siginfo_t*, void* context)
+    {
+        Ring* ring = CurrentRing();
+        if (ring == nullptr)
+            return;
+        const std::uint32_t head = ring->head.load(std::memory_order_relaxed);
+        if (head - ring->tail.load(std::memory_order_acquire) >= RingSize)
+        {
+            ring->dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        ProfileSample11& sample = ring->samples[head % RingSize];
+        const ucontext_t* ucontext = static_cast<const ucontext_t*>(context);
+#if defined(__x86_64__)
+        std::uintptr_t pc = static_cast<std::uintptr_t>(ucontext->uc_mcontext.gregs[REG_RIP]);
+        std::uintptr_t fp = static_cast<std::uintptr_t>(ucontext->uc_mcontext.gregs[REG_RBP]);
+#else
+        std::uintptr_t pc = static_cast<std::uintptr_t>(ucontext->uc_mcontext.pc);
+        std::uintptr_t fp = static_cast<std::uintptr_t>(ucontext->uc_mcontext.regs[29]);
+#endif
+        std::uint32_t depth = 0;
+        sample.frames[depth++] = pc;
+        // Each frame record is { previous fp, return address }. Stop at anything that
+        // isn't an aligned address further up this thread's stack.
+        while (depth < ProfileSample11::MaxFrames && fp >= ring->stackLow
+            && fp + 2 * sizeof(std::uintptr_t) <= ring->stackHigh && fp % sizeof(std::uintptr_t) == 0)
+        {
+            const std::uintptr_t* record = reinterpret_cast<const std::uintptr_t*>(fp);
+            if (record[1] == 0)
+                break;
+            sample.frames[depth++] = record[1];
+            if (record[0] <= fp)
+                break;
+            fp = record[0];
+        }
+        sample.depth = depth;
+        sample.thread = ring->thread;
+        const ZoneStack11* zones = ZoneStack11::GetCurrent();
+        sample.zone = zones != nullptr ? zones->GetInnermost() : nullptr;
+        ring->head.store(head + 1, std::memory_order_release);
+    }
+#endif
+
+    mutable std::mutex                  m_mutex;
+    std::vector<std::unique_ptr<Ring>>  m_rings;
+    long                                m_interval;     // Unit is nanoseconds.
+    bool                                m_running;
+    bool                                m_handlerInstalled;
+};
+
+//! Profiles the calling thread for the lifetime of the object.
+class ProfiledThread11
+{
+public:
+    ProfiledThread11()
+    {
+        SamplingProfiler11::Get().RegisterThread();
+    }
+
+    ~ProfiledThread11()
+    {
+        SamplingProfiler11::Get().UnregisterThread();
+    }
+
+    ProfiledThread11(const ProfiledThread11&) = delete;
+    ProfiledThread11& operator=(const ProfiledThread11&) = delete;
+};
@@ -0,0 +1,239 @@
+// ==================================================================
+// BSD 3-Clause License
+//
+// Copyright (c) 2017-2020, Alexander K. Freed
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// ==================================================================
+
+
+// Language: ISO C++11
+
+// A timer that splits the elapsed time of a section into time on the CPU, time waiting
+// for a CPU on the run queue, and the rest (sleeping or blocked), from the scheduler
+// statistics of the calling thread (/proc/thread-self/schedstat). A slow section with a
+// large run-queue wait was starved of CPU, not slow itself.
+//
+//     SchedTimer11 timer(8);  // Read schedstat on every 8th Start().
+//     timer.Start();
+//     // CODE TO MEASURE.
+//     timer.Stop();
+//     if (timer.IsSampled() && timer.GetRunDelay() > 0.5 * timer.GetElapsed())
+//         std::cout << "starved: waited " << timer.GetRunDelay() << " ms for a CPU\n";
+//
+// Each thread opens its schedstat file once and reads it with pread, a system call of
+// one or two microseconds. To bound the overhead further, only every Nth Start()/Stop()
+// pair reads it. The kernel needs schedstats (CONFIG_SCHED_INFO); the file is missing
+// otherwise, and nothing is sampled. Start() and Stop() must be called on the same thread.
+
+#pragma once
+
+#include "PerformanceTimer11.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+//! The scheduler statistics of a thread at one point in time.
+struct SchedStat11
+{
+    std::uint64_t runTime;      //!< Time on the CPU. Unit is nanoseconds.
+    std::uint64_t runDelay;     //!< Time runnable but waiting on a run queue. Unit is nanoseconds.
+    std::uint64_t timeslices;   //!< Number of times the thread was given a CPU.
+};
+
+//! A PerformanceTimer11 that also reads the calling thread's scheduler statistics at
+//! Start() and Stop(), on every Nth call.
+class SchedTimer11 : public PerformanceTimer11
+{
+public:
+    //! @param[in] sampleEvery Read the statistics on every Nth Start()/Stop() pair. 1 reads them every time.
+    explicit SchedTimer11(unsigned sampleEvery = 1)
+        : m_start()
+        , m_stop()
+        , m_sampleEvery(sampleEvery == 0 ? 1 : sampleEvery)
+        , m_calls(0)
+        , m_sampled(false)
+        , m_stopped(false)
+        , m_sampledCount(0)
+        , m_totalElapsed(0)
+        , m_totalRunDelay(0)
+    {
+    }
+
+    //! Scheduler statistics are only available on Linux with schedstats enabled.
+    //! @return true if the calling thread's scheduler statistics can be read.
+    bool IsSupportedPlatform() const
+    {
+        SchedStat11 stat;
+        return Read(stat);
+    }
+
+    //! Mark the current time as the start and stop point, and on sampled calls read
+    //! the scheduler statistics.
+    void Start()
+    {
+        // The previous pair is complete now; Stop() may be called any number of times.
+        if (IsSampled())
+        {
+            ++m_sampledCount;
+            m_totalElapsed += GetElapsed();
+            m_totalRunDelay += GetRunDelay();
+        }
+        m_stopped = false;
+        m_sampled = m_calls++ % m_sampleEvery == 0 && Read(m_start);
+        m_stop = m_start;
+        PerformanceTimer11::Start();
+    }
+
+    //! Mark the current time as the stop point, and on sampled calls read the scheduler statistics.
+    void Stop()
+    {
+        PerformanceTimer11::Stop();
+        if (m_sampled && Read(m_stop))
+            m_stopped = true;
+    }
+
+    //! @return true if the statistics were read for the last Start()/Stop(). The
+    //!         getters below return 0 otherwise.
+    bool IsSampled() const
+    {
+        return m_sampled && m_stopped;
+    }
+
+    //! @return The time on the CPU from start to stop in milliseconds.
+    double GetRunTime() const
+    {
+        return IsSampled() ? static_cast<double>(m_stop.runTime - m_start.runTime) / 1e6 : 0;
+    }
+
+    //! @return The time spent waiting for a CPU from start to stop in milliseconds.
+    double GetRunDelay() const
+    {
+        return IsSampled() ? static_cast<double>(m_stop.runDelay - m_start.runDelay) / 1e6 : 0;
+    }
+
+    //! @return The rest of the elapsed time (sleeping, blocked on I/O or locks) in
+    //!         milliseconds: elapsed - run time - run delay.
+    double GetOffCpuTime() const
+    {
+        if (!IsSampled())
+            return 0;
+        const double rest = GetElapsed() - GetRunTime() - GetRunDelay();
+        return rest > 0 ? rest : 0;
+    }
+
+    //! @return The number of times the thread was given a CPU from start to stop.
+    std::uint64_t GetTimeslices() const
+    {
+        return IsSampled() ? m_stop.timeslices - m_start.timeslices : 0;
+    }
+
+    //! @return The number of sampled Start()/Stop() pairs so far.
+    std::uint64_t GetSampledCount() const
+    {
+        return m_sampledCount + (IsSampled() ? 1 : 0);
+    }
+
+    //! @return The share of the elapsed time spent waiting for a CPU, over all sampled
+    //!         pairs so far (up to the latest Stop() of the current pair), from 0 to 1.
+    double GetAverageRunDelayFraction() const
+    {
+        const double elapsed = m_totalElapsed + (IsSampled() ? GetElapsed() : 0);
+        const double runDelay = m_totalRunDelay + GetRunDelay();
+        return elapsed > 0 ? runDelay / elapsed : 0;
+    }
+
+private:
+    // Per thread, because /proc/thread-self resolves to the thread that opens it.
+    struct File
+    {
+        int fd;
+
+        File()
+            : fd(-1)
+        {
+#if defined(__linux__)
+            fd = open("/proc/thread-self/schedstat", O_RDONLY | O_CLOEXEC);
+            if (fd < 0)
+            {
+                // Before Linux 3.17.
+                char path[64];
+                std::snprintf(path, sizeof(path), "/proc/self/task/%ld/schedstat", static_cast<long>(syscall(SYS_gettid)));
+                fd = open(path, O_RDONLY | O_CLOEXEC);
+            }
+#endif
+        }
+
+        ~File()
+        {
+#if defined(__linux__)
+            if (fd >= 0)
+                close(fd);
+#endif
+        }
+    };
+
+    // The file is "<run time> <run delay> <timeslices>\n".
+    static bool Read(SchedStat11& stat)
+    {
+#if defined(__linux__)
+        static thread_local File file;
+        if (file.fd < 0)
+            return false;
+        char buffer[96];
+        const ssize_t length = pread(file.fd, buffer, sizeof(buffer) - 1, 0);
+        if (length <= 0)
+            return false;
+        buffer[length] = '\0';
+        char* p = buffer;
+        stat.runTime = std::strtoull(p, &p, 10);
+        stat.runDelay = std::strtoull(p, &p, 10);
+        stat.timeslices = std::strtoull(p, &p, 10);
+        return true;
+#else
+        (void)stat;
+        return false;
+#endif
+    }
+
+    SchedStat11   m_start;
+    SchedStat11   m_stop;
+    unsigned      m_sampleEvery;
+    std::uint64_t m_calls;
+    bool          m_sampled;            // The last Start() read the statistics.
+    bool          m_stopped;            // A Stop() since then read them too.
+    std::uint64_t m_sampledCount;
+    double        m_totalElapsed;       // Unit is milliseconds.
+    double        m_totalRunDelay;      // Unit is milliseconds.
+};
@@ -0,0 +1,81 @@
+// ==================================================================
+// BSD 3-Clause License
+//
+// Copyright (c) 2017-2020, Alexander K. Freed
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// ==================================================================
+
+
+// Language: ISO C++11
+
+#pragma once
+
+#include "PerformanceTimer11.hpp"
+
+#include <type_traits>
+
+//! Runs Start() on construction and Stop() on destruction of any timer with the
+//! PerformanceTimer11 API, so a block of code can be measured without the explicit calls.
+//! e.g.
+//!     AllocTimer11 timer;
+//!     {
+//!         ScopedTimer11<AllocTimer11> scope(timer);  // C++17: ScopedTimer11 scope(timer);
+//!         // CODE TO MEASURE.
+//!     }
+//!     timer.GetElapsed();
+//! The timer type must match exactly: the extended timers hide Start() and Stop()
+//! rather than override them, so a ScopedTimer11<PerformanceTimer11> would skip their
+//! extra measurements.
+template <class Timer>
+class ScopedTimer11
+{
+public:
+    template <class T>
+    explicit ScopedTimer11(T& timer)
+        : m_timer(timer)
+    {
+        static_assert(std::is_same<T, Timer>::value, "ScopedTimer11<Timer> must be given exactly a Timer, not a derived timer");
+        m_timer.Start();
+    }
+
+    ~ScopedTimer11()
+    {
+        m_timer.Stop();
+    }
+
+    ScopedTimer11(const ScopedTimer11&) = delete;
+    ScopedTimer11& operator=(const ScopedTimer11&) = delete;
+
+private:
+    Timer& m_timer;
+};
+
+#if __cplusplus >= 201703L
+template <class Timer>
+ScopedTimer11(Timer&) -> ScopedTimer11<Timer>;
+#endif
@@ -0,0 +1,321 @@
+// ==================================================================
+// BSD 3-Clause License
+//
+// Copyright (c) 2017-2020, Alexander K. Freed
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// ==================================================================
+
+
+// Language: ISO C++11
+
+// Per-frame span and lap recording without the general allocator. Each thread records
+// into a bump arena that is allocated once and reset in O(1) at frame boundaries. At
+// the end of a frame its arena is handed to a reporting thread, and recording
+// continues in a second arena (double buffering).
+//
+//     FrameRecorder11 recorder;  // One per recording thread.
+//
+//     // Loop thread, regulated by PerformanceTimer11:
+//     {
+//         PERFORMANCETIMER11_SITE(physicsSite, "physics");
+//         ScopedSpan11 span(recorder, physicsSite);
+//         // ...
+//         recorder.Lap("broadphase");
+//     }
+//     recorder.EndFrame();
+//
+//     // Reporting thread:
+//     if (const SpanArena11* frame = recorder.AcquireFrame())
+//     {
+//         frame->ForEach(...);
+//         recorder.ReleaseFrame();
+//     }
+
+#pragma once
+
+#include "TickClock11.hpp"
+#include "TimerRegistry11.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+//! One record in an arena: a span (a timed scope) or a lap (a point within a span).
+struct FrameRecord11
+{
+    enum Kind : std::uint16_t { Span, Lap };
+
+    const TimerSite11* site;    //!< Span: the zone. Lap: nullptr.
+    const char*        label;   //!< Lap: its label. Span: the zone's name.
+    TickClock11::Ticks start;   //!< Span: entry time. Lap: the time of the lap.
+    TickClock11::Ticks end;     //!< Span: exit time, or 0 while open. Lap: unused.
+    std::uint32_t      parent;  //!< Index of the enclosing span, or NoParent.
+    std::uint16_t      depth;   //!< Nesting depth. 0 for top-level spans.
+    Kind               kind;
+
+    static const std::uint32_t NoParent = 0xFFFFFFFF;
+};
+
+//! Identifies a span opened with FrameRecorder11::BeginSpan().
+struct FrameSpan11
+{
+    std::uint32_t index;    //!< The span's index in its frame, or FrameRecord11::NoParent if it was dropped.
+    std::uint32_t frame;    //!< The frame the span was opened in.
+};
+
+//! A fixed-capacity bump arena of frame records. Allocating is an index increment;
+//! resetting is setting it back to 0.
+class SpanArena11
+{
+public:
+    //! @param[in] capacity The maximum number of records per frame.
+    explicit SpanArena11(std::size_t capacity)
+        : m_records(new FrameRecord11[capacity])
+        , m_capacity(capacity)
+        , m_size(0)
+        , m_dropped(0)
+        , m_frameStart(0)
+        , m_frameEnd(0)
+    {
+    }
+
+    //! @return A new record, or nullptr if the arena is full (the record is counted as dropped).
+    FrameRecord11* Allocate()
+    {
+        if (m_size == m_capacity)
+        {
+            ++m_dropped;
+            return nullptr;
+        }
+        return &m_records[m_size++];
+    }
+
+    //! Forget all records.
+    void Reset(TickClock11::Ticks frameStart)
+    {
+        m_size = 0;
+        m_dropped = 0;
+        m_frameStart = frameStart;
+        m_frameEnd = 0;
+    }
+
+    //! @return The record at the index.
+    const FrameRecord11& operator[](std::size_t index) const { return m_records[index]; }
+    FrameRecord11&       operator[](std::size_t index)       { return m_records[index]; }
+
+    //! @return The number of records.
+    std::size_t GetSize() const { return m_size; }
+
+    //! @return The number of records that didn't fit.
+    std::size_t GetDropped() const { return m_dropped; }
+
+    //! @return The time the frame started.
+    TickClock11::Ticks GetFrameStart() const { return m_frameStart; }
+
+    //! @return The time the frame ended, or 0 if it hasn't.
+    TickClock11::Ticks GetFrameEnd() const { return m_frameEnd; }
+
+    //! Call a function for every record, in the order they were started.
+    template <class Function>
+    void ForEach(Function&& function) const
+    {
+        for (std::size_t i = 0; i < m_size; ++i)
+            function(m_records[i]);
+    }
+
+private:
+    friend class FrameRecorder11;
+
+    std::unique_ptr<FrameRecord11[]> m_records;
+    std::size_t                      m_capacity;
+    std::size_t                      m_size;
+    std::size_t                      m_dropped;
+    TickClock11::Ticks               m_frameStart;
+    TickClock11::Ticks               m_frameEnd;
+};
+
+//! Records the spans and laps of one thread, frame by frame, and hands finished frames
+//! to one reporting thread. All functions except AcquireFrame() and ReleaseFrame() must
+//! be called on the recording thread.
+class FrameRecorder11
+{
+public:
+    //! Allocates both arenas.
+    //! @param[in] capacity The maximum number of spans and laps per frame.
+    explicit FrameRecorder11(std::size_t capacity = 4096)
+        : m_arenas{ SpanArena11(capacity), SpanArena11(capacity) }
+        , m_active(0)
+        , m_open(FrameRecord11::NoParent)
+        , m_depth(0)
+        , m_frame(0)
+        , m_handoff(nullptr)
+        , m_reporterDone(true)
+        , m_droppedFrames(0)
+    {
+        m_arenas[0].Reset(TickClock11::Now());
+    }
+
+    FrameRecorder11(const FrameRecorder11&) = delete;
+    FrameRecorder11& operator=(const FrameRecorder11&) = delete;
+
+    //! Open a span. Spans nest; close them in reverse order with EndSpan().
+    //! @return The span, to pass to EndSpan().
+    FrameSpan11 BeginSpan(const TimerSite11& site)
+    {
+        SpanArena11& arena = m_arenas[m_active];
+        FrameRecord11* record = arena.Allocate();
+        ++m_depth;
+        FrameSpan11 span;
+        span.index = FrameRecord11::NoParent;
+        span.frame = m_frame;
+        if (record == nullptr)
+            return span;
+        record->site = &site;
+        record->label = site.GetName();
+        record->end = 0;
+        record->parent = m_open;
+        record->depth = static_cast<std::uint16_t>(m_depth - 1);
+        record->kind = FrameRecord11::Span;
+        m_open = static_cast<std::uint32_t>(arena.GetSize() - 1);
+        span.index = m_open;
+        record->start = TickClock11::Now();
+        return span;
+    }
+
+    //! Close the span returned by BeginSpan(). Spans opened before the last EndFrame()
+    //! are ignored: their frame has already been handed off or reused.
+    void EndSpan(const FrameSpan11& span)
+    {
+        const TickClock11::Ticks now = TickClock11::Now();
+        if (span.frame != m_frame)
+            return;
+        if (m_depth > 0)
+            --m_depth;
+        if (span.index == FrameRecord11::NoParent)
+            return;
+        FrameRecord11& record = m_arenas[m_active][span.index];
+        record.end = now;
+        m_open = record.parent;
+    }
+
+    //! Record a lap in the innermost open span.
+    //! @param[in] label The lap label. Must outlive the frame (e.g. a string literal).
+    void Lap(const char* label)
+    {
+        const TickClock11::Ticks now = TickClock11::Now();
+        FrameRecord11* record = m_arenas[m_active].Allocate();
+        if (record == nullptr)
+            return;
+        record->site = nullptr;
+        record->label = label;
+        record->start = now;
+        record->end = 0;
+        record->parent = m_open;
+        record->depth = static_cast<std::uint16_t>(m_depth);
+        record->kind = FrameRecord11::Lap;
+    }
+
+    //! End the frame. If the reporter is done with the previous frame, this frame is
+    //! handed to it and recording switches to the other arena. Otherwise the frame is
+    //! dropped and its arena reused. Spans still open are not carried over: they stay
+    //! open (end 0) in the finished frame, and closing them later has no effect.
+    void EndFrame()
+    {
+        const TickClock11::Ticks now = TickClock11::Now();
+        SpanArena11& arena = m_arenas[m_active];
+        arena.m_frameEnd = now;
+        if (m_reporterDone.load(std::memory_order_acquire))
+        {
+            m_reporterDone.store(false, std::memory_order_relaxed);
+            m_handoff.store(&arena, std::memory_order_release);
+            m_active ^= 1;
+        }
+        else
+        {
+            ++m_droppedFrames;
+        }
+        m_arenas[m_active].Reset(now);
+        m_open = FrameRecord11::NoParent;
+        m_depth = 0;
+        ++m_frame;
+    }
+
+    //! Take the last finished frame. Call from the reporting thread.
+    //! @return The frame, or nullptr if there is no new one. Valid until ReleaseFrame().
+    const SpanArena11* AcquireFrame()
+    {
+        return m_handoff.exchange(nullptr, std::memory_order_acquire);
+    }
+
+    //! Give the frame from AcquireFrame() back, so the recorder can reuse its arena.
+    void ReleaseFrame()
+    {
+        m_reporterDone.store(true, std::memory_order_release);
+    }
+
+    //! @return The number of frames dropped because the reporter was still busy.
+    std::uint64_t GetDroppedFrames() const
+    {
+        return m_droppedFrames;
+    }
+
+private:
+    SpanArena11                 m_arenas[2];
+    unsigned                    m_active;
+    std::uint32_t               m_open;
+    unsigned                    m_depth;
+    std::uint32_t               m_frame;        // Incremented by EndFrame().
+    std::atomic<SpanArena11*>   m_handoff;
+    std::atomic<bool>           m_reporterDone;
+    std::uint64_t               m_droppedFrames;
+};
+
+//! Records the enclosing scope as a span in a FrameRecorder11.
+class ScopedSpan11
+{
+public:
+    ScopedSpan11(FrameRecorder11& recorder, TimerSite11& site)
+        : m_recorder(recorder)
+    {
+        site.EnsureRegistered();
+        m_span = m_recorder.BeginSpan(site);
+    }
+
+    ~ScopedSpan11()
+    {
+        m_recorder.EndSpan(m_span);
+    }
+
+    ScopedSpan11(const ScopedSpan11&) = delete;
+    ScopedSpan11& operator=(const ScopedSpan11&) = delete;
+
+private:
+    FrameRecorder11& m_recorder;
+    FrameSpan11      m_span;
+};
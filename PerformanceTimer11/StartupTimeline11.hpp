@@ -0,0 +1,308 @@
+// ==================================================================
+// BSD 3-Clause License
+//
+// Copyright (c) 2017-2020, Alexander K. Freed
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// ==================================================================
+
+
+// Language: ISO C++11
+
+// Records named phases of process startup, measured from the moment the process was
+// created, and prints them as a waterfall.
+//
+// To also capture static initialization, define PERFORMANCETIMER11_STARTUP_TIMELINE_HOOK
+// in exactly ONE source file before including this header. This adds a mark that runs
+// before other static initializers (GCC/Clang init_priority).
+
+#pragma once
+
+#include "PerformanceTimer11.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <ostream>
+#include <string>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+//! Process-wide startup timeline. All functions are thread-safe. Mark(), Begin(), End()
+//! and MarkReady() do not allocate, so they can be called from static initializers;
+//! Report() allocates.
+class StartupTimeline11
+{
+public:
+    static const std::size_t Capacity = 256;
+
+    //! The process creation time is read from /proc on Linux.
+    //! Elsewhere the timeline starts at the first mark.
+    //! @return true if the process creation time is known.
+    static bool IsSupportedPlatform()
+    {
+        return GetProcessStart() >= 0;
+    }
+
+    //! End the current sequential phase and name it. The phase starts at the previous
+    //! Mark() (or process creation for the first one).
+    //! @param[in] name The phase name. Must outlive the timeline (e.g. a string literal).
+    static void Mark(const char* name)
+    {
+        const std::int64_t now = Now();
+        const std::int64_t start = LastMark().exchange(now, std::memory_order_acq_rel);
+        Add(name, start, now);
+    }
+
+    //! Begin a phase that may overlap with others (e.g. initialization on another thread).
+    //! @param[in] name The phase name. Must outlive the timeline (e.g. a string literal).
+    //! @return The phase id to pass to End(), or Capacity if the timeline is full.
+    static std::size_t Begin(const char* name)
+    {
+        return Add(name, Now(), 0);
+    }
+
+    //! End a phase started with Begin().
+    static void End(std::size_t id)
+    {
+        if (id >= Capacity)
+            return;
+        Entries()[id].end.store(Now(), std::memory_order_release);
+    }
+
+    //! End the last sequential phase with the name "ready" and stop the timeline.
+    static void MarkReady()
+    {
+        Mark("ready");
+        ReadyTime().store(LastMark().load(std::memory_order_acquire), std::memory_order_release);
+    }
+
+    //! @return true once MarkReady() has been called.
+    static bool IsReady()
+    {
+        return ReadyTime().load(std::memory_order_acquire) != 0;
+    }
+
+    //! @return The time from process creation to MarkReady() in milliseconds, or 0 if not ready yet.
+    static double GetTimeToReady()
+    {
+        const std::int64_t ready = ReadyTime().load(std::memory_order_acquire);
+        return ready == 0 ? 0.0 : (ready - Origin()) / 1e6;
+    }
+
+    //! Write the phases as a waterfall, in order of their start time.
+    //! @param[in] os The stream to write to.
+    //! @param[in] width The width of the bar chart in characters.
+    static void Report(std::ostream& os, std::size_t width = 50)
+    {
+        width = std::max<std::size_t>(width, 1);
+        const std::int64_t origin = Origin();
+        const std::size_t count = std::min(Count().load(std::memory_order_acquire), std::size_t(Capacity));
+
+        std::size_t order[Capacity];
+        std::size_t rows = 0;
+        std::int64_t last = Now();
+        if (IsReady())
+            last = ReadyTime().load(std::memory_order_acquire);
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            if (Entries()[i].name.load(std::memory_order_acquire) != nullptr)
+                order[rows++] = i;
+        }
+        std::sort(order, order + rows, [](std::size_t a, std::size_t b) {
+            return Entries()[a].start < Entries()[b].start;
+        });
+        for (std::size_t r = 0; r < rows; ++r)
+            last = std::max(last, Entries()[order[r]].end.load(std::memory_order_acquire));
+
+        const double total = static_cast<double>(std::max<std::int64_t>(last - origin, 1));
+        os << "Startup timeline (ms from " << (IsSupportedPlatform() ? "process creation" : "first mark") << ")\n";
+        for (std::size_t r = 0; r < rows; ++r)
+        {
+            const Entry& entry = Entries()[order[r]];
+            const std::int64_t start = std::max(entry.start, origin);
+            std::int64_t end = entry.end.load(std::memory_order_acquire);
+            const bool open = end == 0;
+            if (open)
+                end = std::max(last, start);  // A phase begun after the last end runs to its own start.
+
+            const std::size_t from = std::min(static_cast<std::size_t>((start - origin) / total * width), width - 1);
+            std::size_t to = static_cast<std::size_t>((end - origin) / total * width);
+            to = std::min(std::max(to, from + 1), width);
+            os << std::left << std::setw(24) << entry.name.load(std::memory_order_relaxed) << std::right << std::fixed
+               << std::setprecision(1) << std::setw(10) << (start - origin) / 1e6
+               << std::setw(10) << (end - start) / 1e6 << (open ? "+ |" : "  |")
+               << std::string(from, ' ') << std::string(to - from, '#') << std::string(width - to, ' ') << "|\n";
+        }
+        if (IsReady())
+            os << "ready after " << std::setprecision(1) << GetTimeToReady() << " ms\n";
+    }
+
+    //! @return The time of process creation in nanoseconds since boot, or -1 if unknown.
+    static std::int64_t GetProcessStart()
+    {
+        static const std::int64_t start = ReadProcessStart();
+        return start;
+    }
+
+private:
+    struct Entry
+    {
+        std::atomic<const char*>  name;  // Set last; nullptr while the entry is being written.
+        std::int64_t              start;
+        std::atomic<std::int64_t> end;
+    };
+
+    static std::size_t Add(const char* name, std::int64_t start, std::int64_t end)
+    {
+        const std::size_t id = Count().fetch_add(1, std::memory_order_relaxed);
+        if (id >= Capacity)
+            return Capacity;
+        Entry& entry = Entries()[id];
+        entry.start = start;
+        entry.end.store(end, std::memory_order_relaxed);
+        entry.name.store(name, std::memory_order_release);
+        return id;
+    }
+
+    // Nanoseconds since boot, including time suspended, on Linux. Elsewhere the
+    // PerformanceTimer11 clock, with the origin at the first mark.
+    static std::int64_t Now()
+    {
+#if defined(__linux__)
+        timespec ts;
+        clock_gettime(CLOCK_BOOTTIME, &ts);
+        return static_cast<std::int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            PerformanceTimer11::Clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    static std::int64_t Origin()
+    {
+        const std::int64_t start = GetProcessStart();
+        if (start >= 0)
+            return start;
+        const std::size_t count = std::min(Count().load(std::memory_order_acquire), std::size_t(Capacity));
+        return count == 0 ? Now() : Entries()[0].start;
+    }
+
+    // Field 22 of /proc/self/stat is the start time in clock ticks since boot.
+    // The command name (field 2) may contain spaces, so parsing starts after its ')'.
+    static std::int64_t ReadProcessStart()
+    {
+#if defined(__linux__)
+        const int fd = open("/proc/self/stat", O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return -1;
+        char buffer[1024];
+        std::size_t length = 0;
+        ssize_t size;
+        while (length < sizeof(buffer) - 1 && (size = read(fd, buffer + length, sizeof(buffer) - 1 - length)) > 0)
+            length += static_cast<std::size_t>(size);
+        close(fd);
+        buffer[length] = '\0';
+
+        const char* p = buffer + length;
+        while (p > buffer && *p != ')')
+            --p;
+        if (*p != ')')
+            return -1;
+        ++p;
+        for (int field = 2; field < 22 && *p != '\0'; ++p)
+        {
+            if (*p == ' ')
+                ++field;
+        }
+        char* end = nullptr;
+        const unsigned long long ticks = std::strtoull(p, &end, 10);
+        if (end == p)
+            return -1;
+        const long ticksPerSecond = sysconf(_SC_CLK_TCK);
+        if (ticksPerSecond <= 0)
+            return -1;
+        return static_cast<std::int64_t>(ticks) * (1000000000 / ticksPerSecond);
+#else
+        return -1;
+#endif
+    }
+
+    static Entry* Entries()
+    {
+        static Entry entries[Capacity];
+        return entries;
+    }
+
+    static std::atomic<std::size_t>& Count()
+    {
+        static std::atomic<std::size_t> count(0);
+        return count;
+    }
+
+    static std::atomic<std::int64_t>& LastMark()
+    {
+        static std::atomic<std::int64_t> last(Origin());
+        return last;
+    }
+
+    static std::atomic<std::int64_t>& ReadyTime()
+    {
+        static std::atomic<std::int64_t> ready(0);
+        return ready;
+    }
+};
+
+
+#if defined(PERFORMANCETIMER11_STARTUP_TIMELINE_HOOK)
+
+// ===========================================================================
+// The static initialization hook
+
+namespace
+{
+    struct StartupTimeline11Hook
+    {
+        StartupTimeline11Hook() { StartupTimeline11::Mark("exec, loading"); }
+    };
+
+#if defined(__GNUC__)
+    // 101 is the first priority available to applications.
+    StartupTimeline11Hook g_startupTimeline11Hook __attribute__((init_priority(101)));
+#else
+    StartupTimeline11Hook g_startupTimeline11Hook;
+#endif
+}
+
+#endif  // defined(PERFORMANCETIMER11_STARTUP_TIMELINE_HOOK)
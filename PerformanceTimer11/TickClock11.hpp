@@ -0,0 +1,74 @@
+// ==================================================================
+// BSD 3-Clause License
+//
+// Copyright (c) 2017-2020, Alexander K. Freed
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// ==================================================================
+
+
+// Language: ISO C++11
+
+#pragma once
+
+#include "PerformanceTimer11.hpp"
+
+#include <cstdint>
+
+//! Raw integer ticks from the same clock PerformanceTimer11 uses.
+//! The extensions record plain integers in their hot paths and only convert to
+//! milliseconds when reporting.
+class TickClock11
+{
+public:
+    using Clock = PerformanceTimer11::Clock;
+    using Ticks = std::int64_t;
+
+    //! @return The current time in clock ticks.
+    static Ticks Now()
+    {
+        return static_cast<Ticks>(Clock::now().time_since_epoch().count());
+    }
+
+    //! @return The number of ticks in one second.
+    static double TicksPerSecond()
+    {
+        return static_cast<double>(Clock::period::den) / Clock::period::num;
+    }
+
+    //! @return The tick count converted to milliseconds.
+    static double ToMilliseconds(Ticks ticks)
+    {
+        return static_cast<double>(ticks) * 1000.0 / TicksPerSecond();
+    }
+
+    //! @return The number of ticks in the given number of milliseconds.
+    static Ticks FromMilliseconds(double milliseconds)
+    {
+        return static_cast<Ticks>(milliseconds * TicksPerSecond() / 1000.0);
+    }
+};
@@ -0,0 +1,240 @@
+// ==================================================================
+// BSD 3-Clause License
+//
+// Copyright (c) 2017-2020, Alexander K. Freed
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// ==================================================================
+
+
+// Language: ISO C++11
+
+// Adaptive timeouts and hedging delays computed from measured call durations.
+// Keep one estimator per destination: each has a fixed size and is updated lock-free.
+
+#pragma once
+
+#include "LatencyHistogram11.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+
+//! The Jacobson/Karels estimator used by TCP (RFC 6298): a smoothed mean (SRTT) and
+//! mean deviation (RTTVAR) of the samples, with timeout = SRTT + 4 * RTTVAR.
+//! Both are packed into one atomic word, so updates from several threads never tear.
+class RttEstimator11
+{
+public:
+    RttEstimator11()
+        : m_state(0)
+        , m_minTimeout(1)
+        , m_maxTimeout(60000)
+    {
+    }
+
+    RttEstimator11(const RttEstimator11&) = delete;
+    RttEstimator11& operator=(const RttEstimator11&) = delete;
+
+    //! Set the range of timeouts returned. Unit is milliseconds. Default is 1 to 60000.
+    void SetBounds(double minTimeout, double maxTimeout)
+    {
+        assert(minTimeout <= maxTimeout);
+        m_minTimeout = minTimeout;
+        m_maxTimeout = maxTimeout;
+    }
+
+    //! Add one measured duration, e.g. PerformanceTimer11::GetElapsed() of a call.
+    //! @param[in] milliseconds The sample.
+    void AddSample(double milliseconds)
+    {
+        const std::int64_t sample = static_cast<std::int64_t>(
+            std::min<std::uint64_t>(LatencyHistogram11::ToMicroseconds(milliseconds), 0x7FFFFFFF));
+        std::uint64_t state = m_state.load(std::memory_order_relaxed);
+        std::uint64_t next;
+        do
+        {
+            std::int64_t srtt = static_cast<std::int64_t>(state >> 32);
+            std::int64_t rttvar = static_cast<std::int64_t>(state & 0xFFFFFFFF);
+            if (state == 0)
+            {
+                srtt = sample;
+                rttvar = sample / 2;
+            }
+            else
+            {
+                // RTTVAR = 3/4 RTTVAR + 1/4 |SRTT - R|, then SRTT = 7/8 SRTT + 1/8 R.
+                const std::int64_t error = sample - srtt;
+                rttvar += ((error < 0 ? -error : error) - rttvar) / 4;
+                srtt += error / 8;
+            }
+            // SRTT of 0 is reserved for "no samples".
+            next = (static_cast<std::uint64_t>(std::max<std::int64_t>(srtt, 1)) << 32)
+                | static_cast<std::uint64_t>(rttvar);
+        } while (!m_state.compare_exchange_weak(state, next, std::memory_order_relaxed));
+    }
+
+    //! @return The smoothed duration in milliseconds, or 0 before the first sample.
+    double GetSmoothed() const
+    {
+        return static_cast<double>(m_state.load(std::memory_order_relaxed) >> 32) / 1000.0;
+    }
+
+    //! @return The mean deviation in milliseconds.
+    double GetDeviation() const
+    {
+        return static_cast<double>(m_state.load(std::memory_order_relaxed) & 0xFFFFFFFF) / 1000.0;
+    }
+
+    //! @return SRTT + 4 * RTTVAR in milliseconds, within the bounds. The maximum before the first sample.
+    double GetTimeout() const
+    {
+        const std::uint64_t state = m_state.load(std::memory_order_relaxed);
+        if (state == 0)
+            return m_maxTimeout;
+        return Clamp(static_cast<double>(state >> 32) / 1000.0 + 4 * static_cast<double>(state & 0xFFFFFFFF) / 1000.0);
+    }
+
+    //! @return SRTT + 2 * RTTVAR in milliseconds: how long to wait before sending a hedged
+    //! (duplicate) request. The maximum before the first sample.
+    double GetHedgeDelay() const
+    {
+        const std::uint64_t state = m_state.load(std::memory_order_relaxed);
+        if (state == 0)
+            return m_maxTimeout;
+        return Clamp(static_cast<double>(state >> 32) / 1000.0 + 2 * static_cast<double>(state & 0xFFFFFFFF) / 1000.0);
+    }
+
+private:
+    double Clamp(double timeout) const
+    {
+        return std::min(std::max(timeout, m_minTimeout), m_maxTimeout);
+    }
+
+    std::atomic<std::uint64_t> m_state;  // SRTT << 32 | RTTVAR, in microseconds.
+    double m_minTimeout;
+    double m_maxTimeout;
+};
+
+//! Timeouts from quantiles of the recent samples instead of mean and deviation.
+//! Better for multi-modal or heavy-tailed latencies, where mean + k * deviation is
+//! either too tight or far too loose. The histogram decays every N samples so that
+//! it follows changes in the destination.
+class QuantileTimeoutEstimator11
+{
+public:
+    QuantileTimeoutEstimator11()
+        : m_timeoutQuantile(0.999)
+        , m_hedgeQuantile(0.95)
+        , m_margin(1.5)
+        , m_minTimeout(1)
+        , m_maxTimeout(60000)
+        , m_decayPeriod(10000)
+        , m_samples(0)
+    {
+    }
+
+    QuantileTimeoutEstimator11(const QuantileTimeoutEstimator11&) = delete;
+    QuantileTimeoutEstimator11& operator=(const QuantileTimeoutEstimator11&) = delete;
+
+    //! Set the quantiles that timeouts and hedging delays are based on. Default is 0.999 and 0.95.
+    void SetQuantiles(double timeoutQuantile, double hedgeQuantile)
+    {
+        m_timeoutQuantile = timeoutQuantile;
+        m_hedgeQuantile = hedgeQuantile;
+    }
+
+    //! Set the factor the timeout quantile is multiplied by. Default is 1.5.
+    void SetMargin(double margin)
+    {
+        m_margin = margin;
+    }
+
+    //! Set the range of timeouts returned. Unit is milliseconds. Default is 1 to 60000.
+    void SetBounds(double minTimeout, double maxTimeout)
+    {
+        assert(minTimeout <= maxTimeout);
+        m_minTimeout = minTimeout;
+        m_maxTimeout = maxTimeout;
+    }
+
+    //! Set how many samples are added between halvings of the histogram. Default is 10000.
+    void SetDecayPeriod(std::uint64_t samples)
+    {
+        assert(samples > 0);
+        m_decayPeriod = samples;
+    }
+
+    //! Add one measured duration, e.g. PerformanceTimer11::GetElapsed() of a call.
+    //! @param[in] milliseconds The sample.
+    void AddSample(double milliseconds)
+    {
+        m_histogram.Record(milliseconds);
+        if ((m_samples.fetch_add(1, std::memory_order_relaxed) + 1) % m_decayPeriod == 0)
+            m_histogram.Decay();
+    }
+
+    //! @return The timeout quantile times the margin in milliseconds, within the bounds.
+    //! The maximum before the first sample.
+    double GetTimeout() const
+    {
+        if (m_histogram.GetCount() == 0)
+            return m_maxTimeout;
+        return Clamp(m_histogram.GetQuantile(m_timeoutQuantile) * m_margin);
+    }
+
+    //! @return The hedge quantile in milliseconds: how long to wait before sending a
+    //! hedged (duplicate) request. The maximum before the first sample.
+    double GetHedgeDelay() const
+    {
+        if (m_histogram.GetCount() == 0)
+            return m_maxTimeout;
+        return Clamp(m_histogram.GetQuantile(m_hedgeQuantile));
+    }
+
+    //! @return The samples.
+    const LatencyHistogram11& GetHistogram() const
+    {
+        return m_histogram;
+    }
+
+private:
+    double Clamp(double timeout) const
+    {
+        return std::min(std::max(timeout, m_minTimeout), m_maxTimeout);
+    }
+
+    LatencyHistogram11         m_histogram;
+    double                     m_timeoutQuantile;
+    double                     m_hedgeQuantile;
+    double                     m_margin;
+    double                     m_minTimeout;
+    double                     m_maxTimeout;
+    std::uint64_t              m_decayPeriod;
+    std::atomic<std::uint64_t> m_samples;
+};
@@ -0,0 +1,294 @@
+// ==================================================================
+// BSD 3-Clause License
+//
+// Copyright (c) 2017-2020, Alexander K. Freed
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// ==================================================================
+
+
+// Language: ISO C++11
+
+// Named timing sites ("zones") without any lookup by name at run time. Each
+// instrumentation site owns a static descriptor that is constant-initialized (so it
+// needs no guard variable) and adds itself to a lock-free intrusive list the first time
+// it runs. From then on the hot path only uses a direct reference to it. Zones are
+// also tracked on a per-thread stack for crash and stall dumps (see ZoneStack11.hpp),
+// and can fire USDT probes for bpftrace and perf (see Usdt11.hpp).
+//
+//     void Update()
+//     {
+//         PERFORMANCETIMER11_ZONE("update");
+//         // CODE TO MEASURE.
+//     }
+//
+//     TimerRegistry11::Report(std::cout);
+
+#pragma once
+
+#include "TickClock11.hpp"
+#include "Usdt11.hpp"
+#include "ZoneStack11.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <vector>
+
+//! The static descriptor and statistics of one instrumentation site.
+class TimerSite11
+{
+public:
+    constexpr TimerSite11(const char* name, const char* file, int line)
+        : m_name(name)
+        , m_file(file)
+        , m_line(line)
+        , m_state(Unregistered)
+        , m_id(0)
+        , m_next(nullptr)
+        , m_count(0)
+        , m_ticks(0)
+        , m_maxTicks(0)
+    {
+    }
+
+    TimerSite11(const TimerSite11&) = delete;
+    TimerSite11& operator=(const TimerSite11&) = delete;
+
+    const char* GetName() const { return m_name; }
+    const char* GetFile() const { return m_file; }
+    int         GetLine() const { return m_line; }
+
+    //! @return A small number identifying the site, assigned in registration order from 1.
+    //! 0 until the site is registered.
+    std::uint32_t GetId() const { return m_id; }
+
+    //! @return The number of recorded measurements.
+    std::uint64_t GetCount() const { return m_count.load(std::memory_order_relaxed); }
+
+    //! @return The total recorded time in milliseconds.
+    double GetTotalTime() const { return TickClock11::ToMilliseconds(m_ticks.load(std::memory_order_relaxed)); }
+
+    //! @return The longest recorded time in milliseconds.
+    double GetMaxTime() const { return TickClock11::ToMilliseconds(m_maxTicks.load(std::memory_order_relaxed)); }
+
+    //! @return The next registered site, or nullptr at the end of the list.
+    const TimerSite11* GetNext() const { return m_next; }
+
+    //! Add the site to the registry if this is the first time it is used.
+    //! Once registered, this is a single atomic load.
+    void EnsureRegistered()
+    {
+        if (m_state.load(std::memory_order_acquire) != Registered)
+            Register();
+    }
+
+    //! Record one measurement.
+    void Record(TickClock11::Ticks ticks)
+    {
+        m_count.fetch_add(1, std::memory_order_relaxed);
+        m_ticks.fetch_add(ticks, std::memory_order_relaxed);
+        TickClock11::Ticks max = m_maxTicks.load(std::memory_order_relaxed);
+        while (ticks > max && !m_maxTicks.compare_exchange_weak(max, ticks, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    //! Clear the statistics. The site stays registered.
+    void Reset()
+    {
+        m_count.store(0, std::memory_order_relaxed);
+        m_ticks.store(0, std::memory_order_relaxed);
+        m_maxTicks.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    friend class TimerRegistry11;
+
+    enum State { Unregistered, Registering, Registered };
+
+    void Register();
+
+    const char*                     m_name;
+    const char*                     m_file;
+    int                             m_line;
+    std::atomic<int>                m_state;
+    std::uint32_t                   m_id;
+    TimerSite11*                    m_next;
+    std::atomic<std::uint64_t>      m_count;
+    std::atomic<TickClock11::Ticks> m_ticks;
+    std::atomic<TickClock11::Ticks> m_maxTicks;
+};
+
+//! The list of all registered sites.
+class TimerRegistry11
+{
+public:
+    //! @return The most recently registered site, or nullptr. Follow GetNext() from it.
+    //! Safe while other threads register sites: a site is only published once it is
+    //! complete, and sites are never removed.
+    static const TimerSite11* GetFirst()
+    {
+        return Head().load(std::memory_order_acquire);
+    }
+
+    //! @return The number of registered sites.
+    static std::uint32_t GetCount()
+    {
+        return Count().load(std::memory_order_acquire);
+    }
+
+    //! Call a function for every registered site.
+    template <class Function>
+    static void ForEach(Function&& function)
+    {
+        for (const TimerSite11* site = GetFirst(); site != nullptr; site = site->GetNext())
+            function(*site);
+    }
+
+    //! Clear the statistics of every registered site.
+    static void Reset()
+    {
+        for (const TimerSite11* site = GetFirst(); site != nullptr; site = site->GetNext())
+            const_cast<TimerSite11*>(site)->Reset();
+    }
+
+    //! Write a table of the sites that recorded something, ordered by total time.
+    //! @param[in] os The stream to write to.
+    static void Report(std::ostream& os)
+    {
+        std::vector<const TimerSite11*> sites;
+        ForEach([&sites](const TimerSite11& site) {
+            if (site.GetCount() != 0)
+                sites.push_back(&site);
+        });
+        std::sort(sites.begin(), sites.end(), [](const TimerSite11* a, const TimerSite11* b) {
+            return a->GetTotalTime() > b->GetTotalTime();
+        });
+
+        os << std::left << std::setw(24) << "zone" << std::right << std::setw(12) << "count"
+           << std::setw(12) << "total.ms" << std::setw(12) << "avg.ms" << std::setw(12) << "max.ms" << "  location\n";
+        for (const TimerSite11* entry : sites)
+        {
+            const TimerSite11& site = *entry;
+            os << std::left << std::setw(24) << site.GetName() << std::right << std::fixed << std::setprecision(3)
+               << std::setw(12) << site.GetCount() << std::setw(12) << site.GetTotalTime()
+               << std::setw(12) << site.GetTotalTime() / static_cast<double>(site.GetCount())
+               << std::setw(12) << site.GetMaxTime() << "  " << site.GetFile() << ':' << site.GetLine() << '\n';
+        }
+    }
+
+private:
+    friend class TimerSite11;
+
+    static std::atomic<TimerSite11*>& Head()
+    {
+        static std::atomic<TimerSite11*> head(nullptr);
+        return head;
+    }
+
+    static std::atomic<std::uint32_t>& Count()
+    {
+        static std::atomic<std::uint32_t> count(0);
+        return count;
+    }
+};
+
+// One thread claims the site; others that race it on first use wait the few
+// instructions until it is published.
+inline void TimerSite11::Register()
+{
+    int state = Unregistered;
+    if (m_state.compare_exchange_strong(state, Registering, std::memory_order_acquire))
+    {
+        m_id = TimerRegistry11::Count().fetch_add(1, std::memory_order_relaxed) + 1;
+        TimerSite11* head = TimerRegistry11::Head().load(std::memory_order_relaxed);
+        do
+        {
+            m_next = head;
+        } while (!TimerRegistry11::Head().compare_exchange_weak(head, this, std::memory_order_release, std::memory_order_relaxed));
+        m_state.store(Registered, std::memory_order_release);
+        return;
+    }
+    while (m_state.load(std::memory_order_acquire) != Registered)
+    {
+    }
+}
+
+//! Measures the enclosing scope and records it in a site.
+class ZoneTimer11
+{
+public:
+    explicit ZoneTimer11(TimerSite11& site)
+        : m_site(site)
+        , m_stack(ZoneStack11::ForThread())
+    {
+        m_site.EnsureRegistered();
+        m_start = TickClock11::Now();
+        if (m_stack != nullptr)
+            m_stack->Push(&m_site, m_site.GetName(), m_start);
+        PERFORMANCETIMER11_USDT_ZONE_START(m_site.GetId(), m_start);
+    }
+
+    ~ZoneTimer11()
+    {
+        const TickClock11::Ticks elapsed = TickClock11::Now() - m_start;
+        m_site.Record(elapsed);
+        PERFORMANCETIMER11_USDT_ZONE_STOP(m_site.GetId(), elapsed);
+        if (m_stack != nullptr)
+            m_stack->Pop();
+    }
+
+    ZoneTimer11(const ZoneTimer11&) = delete;
+    ZoneTimer11& operator=(const ZoneTimer11&) = delete;
+
+    //! @return The site being measured.
+    const TimerSite11& GetSite() const { return m_site; }
+
+    //! @return The time the zone was entered.
+    TickClock11::Ticks GetStart() const { return m_start; }
+
+private:
+    TimerSite11&       m_site;
+    ZoneStack11*       m_stack;
+    TickClock11::Ticks m_start;
+};
+
+#define PERFORMANCETIMER11_CONCAT_(a, b) a##b
+#define PERFORMANCETIMER11_CONCAT(a, b) PERFORMANCETIMER11_CONCAT_(a, b)
+
+//! Declare a constant-initialized site for the current source location, in a variable
+//! of the given name. The name must be a string literal (or another constant).
+#define PERFORMANCETIMER11_SITE(variable, name) \
+    static TimerSite11 variable((name), __FILE__, __LINE__)
+
+//! Measure the rest of the enclosing scope as a zone with the given name.
+#define PERFORMANCETIMER11_ZONE(name) \
+    PERFORMANCETIMER11_SITE(PERFORMANCETIMER11_CONCAT(performanceTimer11Site, __LINE__), name); \
+    ZoneTimer11 PERFORMANCETIMER11_CONCAT(performanceTimer11Zone, __LINE__)(PERFORMANCETIMER11_CONCAT(performanceTimer11Site, __LINE__))
@@ -0,0 +1,364 @@
+// ==================================================================
+// BSD 3-Clause License
+//
+// Copyright (c) 2017-2020, Alexander K. Freed
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// ==================================================================
+
+
+// Language: ISO C++11
+
+// Zone begin/end markers in the kernel's ftrace buffer, so that trace-cmd, perf and
+// Perfetto show timed sections on the same timeline as scheduling and IRQ events.
+//
+// By default markers go to tracefs trace_marker as text in the "B|pid|name" / "E|pid"
+// form that trace viewers draw as slices. Each is written immediately, because its
+// time is the time of the write. Both marker files are opened once.
+//
+// SetRaw(true) switches to compact binary records in trace_marker_raw, which can be
+// batched per thread (SetBatchSize()). The tools show these only as raw_data events,
+// not slices: they need a decoder for TraceMarkerRecord11. Each record carries its own
+// CLOCK_MONOTONIC time, so record the trace with the matching clock (trace-cmd record
+// -C mono) to line them up with kernel events.
+//
+//     void Decode()
+//     {
+//         PERFORMANCETIMER11_MARKED_ZONE("decode");
+//         // CODE TO MEASURE.
+//     }
+//
+//     trace-cmd record -e sched -e irq -e ftrace:print ./app
+//
+// Writing to tracefs needs permission (root, or a tracefs mounted for the user).
+// Without it, or on other platforms, markers are dropped.
+
+#pragma once
+
+#include "TimerRegistry11.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+//! One raw marker record. A trace_marker_raw event holds a 4-byte tag
+//! (TraceMarker11::RawTag) followed by one or more of these.
+struct TraceMarkerRecord11
+{
+    enum Kind : std::uint32_t { Begin, End };
+
+    std::uint32_t      zone;    //!< TimerSite11::GetId().
+    Kind               kind;
+    TickClock11::Ticks ticks;   //!< The TickClock11 time of the marker.
+};
+
+//! The process-wide ftrace marker sink.
+class TraceMarker11
+{
+public:
+    static const std::uint32_t RawTag = 0x31315450;     // "PT11"
+    static const std::uint32_t MaxBatch = 64;
+
+    //! @return The sink, opened in the default tracefs location on first use.
+    static TraceMarker11& Get()
+    {
+        static TraceMarker11* marker = new TraceMarker11();  // Never destroyed, so thread-exit flushes can use it.
+        return *marker;
+    }
+
+    TraceMarker11(const TraceMarker11&) = delete;
+    TraceMarker11& operator=(const TraceMarker11&) = delete;
+
+    //! Open the marker files in a tracefs directory, replacing the current ones. Not
+    //! safe while other threads write markers; call early, e.g. for a non-default mount.
+    //! @param[in] directory e.g. "/sys/kernel/tracing".
+    //! @return true if either marker file could be opened.
+    bool Open(const char* directory)
+    {
+#if defined(__linux__)
+        Close();
+        const std::string base(directory);
+        m_rawFd = open((base + "/trace_marker_raw").c_str(), O_WRONLY | O_CLOEXEC);
+        m_textFd = open((base + "/trace_marker").c_str(), O_WRONLY | O_CLOEXEC);
+        return IsOpen();
+#else
+        (void)directory;
+        return false;
+#endif
+    }
+
+    //! @return true if markers are being written.
+    bool IsOpen() const
+    {
+        return m_rawFd >= 0 || m_textFd >= 0;
+    }
+
+    //! Write binary records to trace_marker_raw instead of text to trace_marker.
+    //! Not safe while other threads write markers. Ignored if trace_marker_raw
+    //! couldn't be opened.
+    void SetRaw(bool raw)
+    {
+        m_raw = raw;
+    }
+
+    //! @return true if markers are written as binary records to trace_marker_raw.
+    bool IsRaw() const
+    {
+        return m_raw && m_rawFd >= 0;
+    }
+
+    //! Set how many raw records each thread collects before writing them. 1 (the
+    //! default) writes every marker immediately. Has no effect on text markers.
+    void SetBatchSize(std::uint32_t size)
+    {
+        m_batchSize.store(size < 1 ? 1 : size > MaxBatch ? std::uint32_t(MaxBatch) : size, std::memory_order_relaxed);
+    }
+
+    //! Write a begin marker for a zone.
+    void Begin(const TimerSite11& site, TickClock11::Ticks now)
+    {
+        Mark(site, TraceMarkerRecord11::Begin, now);
+    }
+
+    //! Write an end marker for a zone.
+    void End(const TimerSite11& site, TickClock11::Ticks now)
+    {
+        Mark(site, TraceMarkerRecord11::End, now);
+    }
+
+    //! Write the calling thread's batched records. Threads also flush when they exit.
+    void Flush()
+    {
+        Flush(LocalBatch());
+    }
+
+private:
+    struct Batch
+    {
+        TraceMarkerRecord11 records[MaxBatch];
+        std::uint32_t       count;
+
+        ~Batch()
+        {
+            if (count != 0)
+                TraceMarker11::Get().Flush(*this);
+        }
+    };
+
+    TraceMarker11()
+        : m_rawFd(-1)
+        , m_textFd(-1)
+        , m_raw(false)
+        , m_pid(0)
+        , m_batchSize(1)
+        , m_announced()
+    {
+#if defined(__linux__)
+        m_pid = static_cast<long>(getpid());
+        if (!Open("/sys/kernel/tracing"))
+            Open("/sys/kernel/debug/tracing");
+#endif
+    }
+
+    void Close()
+    {
+#if defined(__linux__)
+        if (m_rawFd >= 0)
+            close(m_rawFd);
+        if (m_textFd >= 0)
+            close(m_textFd);
+#endif
+        m_rawFd = -1;
+        m_textFd = -1;
+    }
+
+    static Batch& LocalBatch()
+    {
+        static thread_local Batch batch;
+        return batch;
+    }
+
+    void Mark(const TimerSite11& site, TraceMarkerRecord11::Kind kind, TickClock11::Ticks now)
+    {
+        if (IsRaw())
+        {
+            Announce(site);
+            Batch& batch = LocalBatch();
+            TraceMarkerRecord11& record = batch.records[batch.count++];
+            record.zone = site.GetId();
+            record.kind = kind;
+            record.ticks = now;
+            if (batch.count >= m_batchSize.load(std::memory_order_relaxed))
+                Flush(batch);
+        }
+        else if (m_textFd >= 0)
+        {
+            char text[128];
+            const int length = kind == TraceMarkerRecord11::Begin
+                ? std::snprintf(text, sizeof(text), "B|%ld|%s", m_pid, site.GetName())
+                : std::snprintf(text, sizeof(text), "E|%ld", m_pid);
+            Write(m_textFd, text, length < static_cast<int>(sizeof(text)) ? static_cast<std::size_t>(length) : sizeof(text) - 1);
+        }
+    }
+
+    void Flush(Batch& batch)
+    {
+        if (batch.count == 0)
+            return;
+        const std::uint32_t tag = RawTag;
+        char buffer[sizeof(tag) + sizeof(batch.records)];
+        std::memcpy(buffer, &tag, sizeof(tag));
+        const std::size_t size = batch.count * sizeof(TraceMarkerRecord11);
+        std::memcpy(buffer + sizeof(tag), batch.records, size);
+        batch.count = 0;
+        Write(m_rawFd, buffer, sizeof(tag) + size);
+    }
+
+    // Raw records only carry zone ids, so each zone's name is written once to the text
+    // marker as "performancetimer11 zone <id> <name>". Ids beyond the bitmap aren't named.
+    void Announce(const TimerSite11& site)
+    {
+        const std::uint32_t id = site.GetId();
+        if (id >= 64 * AnnouncedWords)
+            return;
+        const std::uint64_t bit = std::uint64_t(1) << (id % 64);
+        std::atomic<std::uint64_t>& word = m_announced[id / 64];
+        if ((word.load(std::memory_order_relaxed) & bit) != 0
+            || (word.fetch_or(bit, std::memory_order_relaxed) & bit) != 0)
+            return;
+        if (m_textFd >= 0)
+        {
+            char text[160];
+            const int length = std::snprintf(text, sizeof(text), "performancetimer11 zone %u %s", id, site.GetName());
+            Write(m_textFd, text, length < static_cast<int>(sizeof(text)) ? static_cast<std::size_t>(length) : sizeof(text) - 1);
+        }
+    }
+
+    static void Write(int fd, const char* data, std::size_t size)
+    {
+#if defined(__linux__)
+        if (fd >= 0 && write(fd, data, size) < 0)
+        {
+            // The marker is lost; there is nowhere better to report it.
+        }
+#else
+        (void)fd;
+        (void)data;
+        (void)size;
+#endif
+    }
+
+    static const std::uint32_t AnnouncedWords = 64;
+
+    int                         m_rawFd;
+    int                         m_textFd;
+    bool                        m_raw;
+    long                        m_pid;
+    std::atomic<std::uint32_t>  m_batchSize;
+    std::atomic<std::uint64_t>  m_announced[AnnouncedWords];
+};
+
+//! A ZoneTimer11 that also writes ftrace markers at its start and end.
+class MarkedZone11
+{
+public:
+    explicit MarkedZone11(TimerSite11& site)
+        : m_zone(site)
+    {
+        TraceMarker11::Get().Begin(site, m_zone.GetStart());
+    }
+
+    ~MarkedZone11()
+    {
+        TraceMarker11::Get().End(m_zone.GetSite(), TickClock11::Now());
+    }
+
+    MarkedZone11(const MarkedZone11&) = delete;
+    MarkedZone11& operator=(const MarkedZone11&) = delete;
+
+private:
+    ZoneTimer11 m_zone;
+};
+
+//! A PerformanceTimer11 that writes ftrace markers at Start() and Stop(), for sections
+//! that don't fit a scope.
+class MarkedTimer11 : public PerformanceTimer11
+{
+public:
+    //! @param[in] site Names the section in the trace.
+    explicit MarkedTimer11(TimerSite11& site)
+        : m_site(site)
+        , m_open(false)
+    {
+        m_site.EnsureRegistered();
+    }
+
+    //! Ends the marked section if it is still open.
+    ~MarkedTimer11()
+    {
+        if (m_open)
+            TraceMarker11::Get().End(m_site, TickClock11::Now());
+    }
+
+    void Start()
+    {
+        if (m_open)
+            TraceMarker11::Get().End(m_site, TickClock11::Now());
+        PerformanceTimer11::Start();
+        TraceMarker11::Get().Begin(m_site, TickClock11::Now());
+        m_open = true;
+    }
+
+    //! Only the first Stop() after a Start() writes the end marker. Stop() may be
+    //! called any number of times, but trace viewers close a slice on every end marker.
+    void Stop()
+    {
+        if (m_open)
+        {
+            TraceMarker11::Get().End(m_site, TickClock11::Now());
+            m_open = false;
+        }
+        PerformanceTimer11::Stop();
+    }
+
+private:
+    TimerSite11& m_site;
+    bool         m_open;    // A begin marker was written without its end.
+};
+
+//! Measure the rest of the enclosing scope as a zone, with ftrace markers.
+#define PERFORMANCETIMER11_MARKED_ZONE(name) \
+    PERFORMANCETIMER11_SITE(PERFORMANCETIMER11_CONCAT(performanceTimer11Site, __LINE__), name); \
+    MarkedZone11 PERFORMANCETIMER11_CONCAT(performanceTimer11Zone, __LINE__)(PERFORMANCETIMER11_CONCAT(performanceTimer11Site, __LINE__))
@@ -0,0 +1,410 @@
+// ==================================================================
+// BSD 3-Clause License
+//
+// Copyright (c) 2017-2020, Alexander K. Freed
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// ==================================================================
+
+
+// Language: ISO C++11
+
+// Binary per-process timing traces, and a merger that aligns traces from several
+// processes on CLOCK_MONOTONIC and writes them as one timeline.
+//
+// Each trace records events in TickClock11 ticks and two anchors, (ticks, monotonic)
+// pairs taken when the trace is opened and closed. The merger maps every event to
+// monotonic time through its own trace's anchors, then does a k-way merge with a
+// fixed-size read buffer per trace, so memory doesn't grow with trace length.
+// The output is the Chrome trace event format (chrome://tracing, Perfetto).
+
+#pragma once
+
+#include "ClockCorrelator11.hpp"
+#include "TickClock11.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(_WIN32)
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+//! The kinds of trace events.
+enum TraceEventKind11 : std::uint8_t
+{
+    TraceBegin11   = 0,  //!< A zone starts.
+    TraceEnd11     = 1,  //!< A zone ends.
+    TraceInstant11 = 2   //!< A point in time.
+};
+
+//! One event in a trace file.
+struct TraceRecord11
+{
+    std::int64_t  ticks;   //!< TickClock11 time.
+    std::uint32_t zone;    //!< Id from TraceWriter11::RegisterZone().
+    std::uint16_t thread;  //!< Caller-chosen thread number.
+    std::uint8_t  kind;    //!< TraceEventKind11.
+    std::uint8_t  reserved;
+};
+
+//! The start of a trace file. Followed by the records, then the zone names.
+struct TraceHeader11
+{
+    char          magic[8];       //!< "PT11TRC".
+    std::uint32_t version;
+    std::uint32_t pid;
+    std::int64_t  startTicks;     //!< Anchor taken when the trace was opened.
+    std::int64_t  startMonotonic;
+    std::int64_t  endTicks;       //!< Anchor taken when the trace was closed.
+    std::int64_t  endMonotonic;
+    std::uint64_t recordCount;
+    std::uint64_t namesOffset;    //!< File offset of the zone names.
+    double        ticksPerSecond;
+};
+
+//! Writes one process's trace. Thread-safe; events are buffered and written in blocks.
+class TraceWriter11
+{
+public:
+    //! Passed as the time to Record() to read the clock when the event is appended.
+    static const TickClock11::Ticks Now = INT64_MIN;
+
+    TraceWriter11()
+        : m_file(nullptr)
+        , m_header()
+    {
+    }
+
+    ~TraceWriter11()
+    {
+        Close();
+    }
+
+    TraceWriter11(const TraceWriter11&) = delete;
+    TraceWriter11& operator=(const TraceWriter11&) = delete;
+
+    //! Create the trace file and take the start anchor.
+    //! @return false if the file couldn't be created.
+    bool Open(const char* path)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_file != nullptr)
+            return false;
+        m_file = std::fopen(path, "wb");
+        if (m_file == nullptr)
+            return false;
+
+        m_header = TraceHeader11();
+        std::memcpy(m_header.magic, "PT11TRC", 8);
+        m_header.version = 1;
+#if defined(_WIN32)
+        m_header.pid = static_cast<std::uint32_t>(_getpid());
+#else
+        m_header.pid = static_cast<std::uint32_t>(getpid());
+#endif
+        m_header.ticksPerSecond = TickClock11::TicksPerSecond();
+        TakeAnchor(m_header.startTicks, m_header.startMonotonic);
+        m_buffer.reserve(BufferSize);
+        return std::fwrite(&m_header, sizeof(m_header), 1, m_file) == 1;
+    }
+
+    //! @param[in] name The zone name.
+    //! @return The id to record events for the zone with.
+    std::uint32_t RegisterZone(const std::string& name)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_names.push_back(name);
+        return static_cast<std::uint32_t>(m_names.size() - 1);
+    }
+
+    //! Record an event. The merger expects each trace in time order: times passed in
+    //! must not decrease from one call to the next, across all threads writing to it.
+    //! @param[in] kind The kind of event.
+    //! @param[in] zone The zone id.
+    //! @param[in] thread A number identifying the thread in the merged timeline.
+    //! @param[in] ticks The time of the event, or Now to read the clock under the lock.
+    void Record(TraceEventKind11 kind, std::uint32_t zone, std::uint16_t thread = 0, TickClock11::Ticks ticks = Now)
+    {
+        TraceRecord11 record;
+        record.zone = zone;
+        record.thread = thread;
+        record.kind = kind;
+        record.reserved = 0;
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_file == nullptr)
+            return;
+        record.ticks = ticks == Now ? TickClock11::Now() : ticks;
+        m_buffer.push_back(record);
+        if (m_buffer.size() == BufferSize)
+            Flush();
+    }
+
+    //! Take the end anchor, write the zone names and finish the file.
+    //! @return false if writing failed.
+    bool Close()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_file == nullptr)
+            return false;
+        Flush();
+        TakeAnchor(m_header.endTicks, m_header.endMonotonic);
+        m_header.namesOffset = sizeof(TraceHeader11) + m_header.recordCount * sizeof(TraceRecord11);
+
+        bool ok = true;
+        const std::uint32_t count = static_cast<std::uint32_t>(m_names.size());
+        ok = ok && std::fwrite(&count, sizeof(count), 1, m_file) == 1;
+        for (const std::string& name : m_names)
+        {
+            const std::uint32_t length = static_cast<std::uint32_t>(name.size());
+            ok = ok && std::fwrite(&length, sizeof(length), 1, m_file) == 1;
+            ok = ok && std::fwrite(name.data(), 1, length, m_file) == length;
+        }
+        ok = ok && std::fseek(m_file, 0, SEEK_SET) == 0;
+        ok = ok && std::fwrite(&m_header, sizeof(m_header), 1, m_file) == 1;
+        ok = std::fclose(m_file) == 0 && ok;
+        m_file = nullptr;
+        m_names.clear();
+        return ok;
+    }
+
+private:
+    static const std::size_t BufferSize = 4096;
+
+    // The tick read is bracketed by two monotonic reads; the narrowest of a few
+    // attempts is used.
+    static void TakeAnchor(std::int64_t& ticks, std::int64_t& monotonic)
+    {
+        std::int64_t best = INT64_MAX;
+        for (int i = 0; i < 8; ++i)
+        {
+            const std::int64_t before = ClockCorrelator11::Monotonic();
+            const TickClock11::Ticks now = TickClock11::Now();
+            const std::int64_t after = ClockCorrelator11::Monotonic();
+            if (after - before < best)
+            {
+                best = after - before;
+                ticks = now;
+                monotonic = before + (after - before) / 2;
+            }
+        }
+    }
+
+    void Flush()
+    {
+        if (!m_buffer.empty())
+            m_header.recordCount += std::fwrite(m_buffer.data(), sizeof(TraceRecord11), m_buffer.size(), m_file);
+        m_buffer.clear();
+    }
+
+    std::mutex                 m_mutex;
+    std::FILE*                 m_file;
+    TraceHeader11              m_header;
+    std::vector<TraceRecord11> m_buffer;
+    std::vector<std::string>   m_names;
+};
+
+//! Merges traces written by TraceWriter11 in several processes into one timeline.
+class TraceMerger11
+{
+public:
+    TraceMerger11() = default;
+
+    ~TraceMerger11()
+    {
+        for (Input& input : m_inputs)
+            std::fclose(input.file);
+    }
+
+    TraceMerger11(const TraceMerger11&) = delete;
+    TraceMerger11& operator=(const TraceMerger11&) = delete;
+
+    //! Open a trace and read its header and zone names.
+    //! @return false if the file is missing, not a trace, or was not closed.
+    bool AddInput(const char* path)
+    {
+        Input input;
+        input.file = std::fopen(path, "rb");
+        if (input.file == nullptr)
+            return false;
+        if (!ReadHeader(input))
+        {
+            std::fclose(input.file);
+            return false;
+        }
+        m_inputs.push_back(std::move(input));
+        return true;
+    }
+
+    //! Merge the inputs by monotonic time and write them in the Chrome trace event format.
+    //! Timestamps are microseconds from the earliest trace start.
+    //! @param[in] path The output file.
+    //! @return false if an input couldn't be read or the output couldn't be written.
+    bool WriteChromeTrace(const char* path)
+    {
+        std::FILE* out = std::fopen(path, "wb");
+        if (out == nullptr)
+            return false;
+
+        typedef std::pair<std::int64_t, std::size_t> Head;  // (monotonic, input)
+        std::priority_queue<Head, std::vector<Head>, std::greater<Head> > heads;
+        std::int64_t origin = INT64_MAX;
+        for (std::size_t i = 0; i < m_inputs.size(); ++i)
+        {
+            Input& input = m_inputs[i];
+            origin = std::min(origin, input.header.startMonotonic);
+            if (std::fseek(input.file, sizeof(TraceHeader11), SEEK_SET) != 0)
+                return CloseOutput(out, false);
+            input.remaining = input.header.recordCount;
+            input.buffer.clear();
+            input.position = 0;
+            if (Refill(input))
+                heads.push(Head(ToMonotonic(input, input.buffer[0].ticks), i));
+        }
+
+        bool ok = std::fputs("{\"traceEvents\":[\n", out) >= 0;
+        bool first = true;
+        while (!heads.empty() && ok)
+        {
+            const Head head = heads.top();
+            heads.pop();
+            Input& input = m_inputs[head.second];
+            const TraceRecord11& record = input.buffer[input.position];
+            ok = WriteEvent(out, input, record, head.first - origin, first);
+            first = false;
+
+            if (++input.position == input.buffer.size() && !Refill(input))
+                continue;
+            heads.push(Head(ToMonotonic(input, input.buffer[input.position].ticks), head.second));
+        }
+        ok = ok && std::fputs("\n]}\n", out) >= 0;
+        return CloseOutput(out, ok);
+    }
+
+private:
+    static const std::size_t ReadSize = 4096;
+
+    struct Input
+    {
+        std::FILE*                 file = nullptr;
+        TraceHeader11              header = TraceHeader11();
+        std::vector<std::string>   names;
+        std::vector<TraceRecord11> buffer;
+        std::size_t                position = 0;
+        std::uint64_t              remaining = 0;
+        double                     slope = 1;  // Monotonic nanoseconds per tick.
+    };
+
+    static bool ReadHeader(Input& input)
+    {
+        TraceHeader11& header = input.header;
+        if (std::fread(&header, sizeof(header), 1, input.file) != 1)
+            return false;
+        if (std::memcmp(header.magic, "PT11TRC", 8) != 0 || header.version != 1 || header.namesOffset == 0)
+            return false;
+
+        // Two anchors give the tick rate as seen by CLOCK_MONOTONIC; fall back to the nominal rate.
+        if (header.endTicks != header.startTicks)
+            input.slope = static_cast<double>(header.endMonotonic - header.startMonotonic)
+                / static_cast<double>(header.endTicks - header.startTicks);
+        else
+            input.slope = 1e9 / header.ticksPerSecond;
+
+        if (std::fseek(input.file, static_cast<long>(header.namesOffset), SEEK_SET) != 0)
+            return false;
+        std::uint32_t count = 0;
+        if (std::fread(&count, sizeof(count), 1, input.file) != 1)
+            return false;
+        input.names.resize(count);
+        for (std::string& name : input.names)
+        {
+            std::uint32_t length = 0;
+            if (std::fread(&length, sizeof(length), 1, input.file) != 1)
+                return false;
+            name.resize(length);
+            if (length != 0 && std::fread(&name[0], 1, length, input.file) != length)
+                return false;
+        }
+        return true;
+    }
+
+    static bool Refill(Input& input)
+    {
+        const std::size_t count = static_cast<std::size_t>(std::min<std::uint64_t>(input.remaining, std::uint64_t(ReadSize)));
+        input.buffer.resize(count);
+        input.position = 0;
+        if (count == 0)
+            return false;
+        const std::size_t read = std::fread(input.buffer.data(), sizeof(TraceRecord11), count, input.file);
+        input.buffer.resize(read);
+        input.remaining = read == count ? input.remaining - count : 0;
+        return read != 0;
+    }
+
+    static std::int64_t ToMonotonic(const Input& input, std::int64_t ticks)
+    {
+        return input.header.startMonotonic
+            + static_cast<std::int64_t>(input.slope * static_cast<double>(ticks - input.header.startTicks));
+    }
+
+    static bool WriteEvent(std::FILE* out, const Input& input, const TraceRecord11& record, std::int64_t time, bool first)
+    {
+        static const char phases[] = { 'B', 'E', 'i' };
+        const char phase = record.kind < sizeof(phases) ? phases[record.kind] : 'i';
+        std::string name = record.zone < input.names.size() ? input.names[record.zone] : "?";
+        std::string escaped;
+        for (char c : name)
+        {
+            if (c == '"' || c == '\\')
+                escaped += '\\';
+            if (static_cast<unsigned char>(c) >= 0x20)
+                escaped += c;
+        }
+        return std::fprintf(out, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%u,\"tid\":%u%s}",
+            first ? "" : ",\n", escaped.c_str(), phase, static_cast<double>(time) / 1000.0,
+            input.header.pid, static_cast<unsigned>(record.thread), phase == 'i' ? ",\"s\":\"t\"" : "") > 0;
+    }
+
+    static bool CloseOutput(std::FILE* out, bool ok)
+    {
+        return std::fclose(out) == 0 && ok;
+    }
+
+    std::vector<Input> m_inputs;
+};
@@ -0,0 +1,125 @@
+// ==================================================================
+// BSD 3-Clause License
+//
+// Copyright (c) 2017-2020, Alexander K. Freed
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// ==================================================================
+
+
+// Language: ISO C++11
+
+// USDT (user statically-defined tracing) probes at zone boundaries, for bpftrace,
+// perf and SystemTap. Opt in by defining PERFORMANCETIMER11_USDT in every translation
+// unit (e.g. with add_compile_definitions). The probes are the ELF notes that sys/sdt.h
+// emits (.note.stapsdt, version 3), written out here so nothing is needed at build or
+// run time:
+//
+//     performancetimer11:zone_start(uint32 zone id, int64 start ticks)
+//     performancetimer11:zone_stop(uint32 zone id, int64 elapsed ticks)
+//
+//     bpftrace -e 'usdt:./app:performancetimer11:zone_stop { @[arg0] = hist(arg1); }'
+//
+// Each probe has a semaphore, which a tracer increments while attached. Until then a
+// probe costs a load of the semaphore and a branch not taken, and its arguments are
+// never computed. Zone ids map to names with TimerRegistry11 (see TimerSite11::GetId()).
+//
+// Supported with GCC or Clang on x86-64 and ARM64 ELF targets; elsewhere the probes
+// compile to nothing.
+
+#pragma once
+
+#if defined(PERFORMANCETIMER11_USDT) && defined(__GNUC__) && defined(__ELF__) \
+    && (defined(__x86_64__) || defined(__aarch64__))
+
+// Semaphores must be in .probes and must not be mangled. They are weak so that each
+// translation unit can define them, and hidden so that each shared object has its own.
+#define PERFORMANCETIMER11_USDT_SEMAPHORE(semaphore) \
+    __attribute__((weak, used, section(".probes"), visibility("hidden"))) volatile unsigned short semaphore = 0
+
+extern "C"
+{
+PERFORMANCETIMER11_USDT_SEMAPHORE(performancetimer11_zone_start_semaphore);
+PERFORMANCETIMER11_USDT_SEMAPHORE(performancetimer11_zone_stop_semaphore);
+}
+
+// A nop at the probe address and a note describing it. The note section is in the same
+// group as the enclosing function ("?"), so it is discarded along with a duplicate
+// inline function. _.stapsdt.base lets tools detect prelink adjustments.
+#define PERFORMANCETIMER11_USDT_PROBE2(provider, name, semaphore, arguments, first, second) \
+    __asm__ __volatile__(                                                            \
+        "990: nop\n"                                                                 \
+        ".pushsection .note.stapsdt,\"?\",\"note\"\n"                                \
+        ".balign 4\n"                                                                \
+        ".4byte 992f-991f, 994f-993f, 3\n"                                           \
+        "991: .asciz \"stapsdt\"\n"                                                  \
+        "992: .balign 4\n"                                                           \
+        "993: .8byte 990b\n"                                                         \
+        ".8byte _.stapsdt.base\n"                                                    \
+        ".8byte " #semaphore "\n"                                                    \
+        ".asciz \"" provider "\"\n"                                                  \
+        ".asciz \"" name "\"\n"                                                      \
+        ".asciz \"" arguments "\"\n"                                                 \
+        "994: .balign 4\n"                                                           \
+        ".popsection\n"                                                              \
+        ".ifndef _.stapsdt.base\n"                                                   \
+        ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n"      \
+        ".weak _.stapsdt.base\n"                                                     \
+        ".hidden _.stapsdt.base\n"                                                   \
+        "_.stapsdt.base: .space 1\n"                                                 \
+        ".size _.stapsdt.base, 1\n"                                                  \
+        ".popsection\n"                                                              \
+        ".endif\n"                                                                   \
+        :                                                                            \
+        : [a1] "nor"(first), [a2] "nor"(second))
+
+// Argument specs are "<size>@<operand>", with a negative size for signed arguments.
+#define PERFORMANCETIMER11_USDT_ZONE(name, id, ticks)                                              \
+    do                                                                                             \
+    {                                                                                              \
+        if (__builtin_expect(performancetimer11_##name##_semaphore != 0, 0))                       \
+        {                                                                                          \
+            const unsigned int performanceTimer11Id = (id);                                        \
+            const long long performanceTimer11Ticks = (ticks);                                     \
+            PERFORMANCETIMER11_USDT_PROBE2("performancetimer11", #name,                            \
+                performancetimer11_##name##_semaphore, "4@%[a1] -8@%[a2]",                         \
+                performanceTimer11Id, performanceTimer11Ticks);                                    \
+        }                                                                                          \
+    } while (false)
+
+//! Fire performancetimer11:zone_start, if a tracer is attached.
+#define PERFORMANCETIMER11_USDT_ZONE_START(id, start) PERFORMANCETIMER11_USDT_ZONE(zone_start, id, start)
+
+//! Fire performancetimer11:zone_stop, if a tracer is attached.
+#define PERFORMANCETIMER11_USDT_ZONE_STOP(id, elapsed) PERFORMANCETIMER11_USDT_ZONE(zone_stop, id, elapsed)
+
+#else
+
+#define PERFORMANCETIMER11_USDT_ZONE_START(id, start) do { } while (false)
+#define PERFORMANCETIMER11_USDT_ZONE_STOP(id, elapsed) do { } while (false)
+
+#endif
@@ -0,0 +1,242 @@
+// ==================================================================
+// BSD 3-Clause License
+//
+// Copyright (c) 2017-2020, Alexander K. Freed
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// ==================================================================
+
+
+// Language: ISO C++11
+
+// A steady clock that calls the kernel's vDSO clock_gettime through a cached function
+// pointer, skipping the libc wrapper. The symbol is resolved directly from the vDSO
+// image the kernel maps into every process (AT_SYSINFO_EHDR). If it can't be found,
+// the clock falls back to the clock_gettime system call.
+//
+// Define PERFORMANCETIMER11_USE_VDSO (in every source file, e.g. with the compiler's -D
+// option) to make PerformanceTimer11 and the extensions use this clock.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ratio>
+
+#if defined(__linux__)
+#include <cstring>
+#include <link.h>
+#include <sys/auxv.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+//! A std::chrono clock reading CLOCK_MONOTONIC through the vDSO.
+//! On systems other than Linux it is std::chrono::steady_clock.
+class VdsoClock11
+{
+public:
+    using rep        = std::int64_t;
+    using period     = std::nano;
+    using duration   = std::chrono::duration<rep, period>;
+    using time_point = std::chrono::time_point<VdsoClock11>;
+    static const bool is_steady = true;
+
+    //! @return The current time.
+    static time_point now() noexcept
+    {
+#if defined(__linux__)
+        ClockGettime clockGettime = State<>::function.load(std::memory_order_relaxed);
+        if (clockGettime == nullptr)
+            clockGettime = Resolve();
+        timespec ts;
+        clockGettime(CLOCK_MONOTONIC, &ts);
+        return time_point(duration(static_cast<rep>(ts.tv_sec) * 1000000000 + ts.tv_nsec));
+#else
+        return time_point(std::chrono::duration_cast<duration>(
+            std::chrono::steady_clock::now().time_since_epoch()));
+#endif
+    }
+
+    //! @return true if clock_gettime was found in the vDSO. false if the clock uses the
+    //! system call (or is not on Linux).
+    static bool IsVdsoResolved()
+    {
+#if defined(__linux__)
+        Resolve();
+        return State<>::resolved.load(std::memory_order_relaxed);
+#else
+        return false;
+#endif
+    }
+
+#if defined(__linux__)
+private:
+    using ClockGettime = int (*)(clockid_t, timespec*);
+
+    // A class template so the cached pointer can be defined in this header. It is set
+    // during static initialization, and lazily if now() runs before that.
+    template <class = void>
+    struct State
+    {
+        static std::atomic<ClockGettime> function;
+        static std::atomic<bool>         resolved;
+    };
+
+    static int SystemCall(clockid_t clock, timespec* ts)
+    {
+        return static_cast<int>(syscall(SYS_clock_gettime, clock, ts));
+    }
+
+    static ClockGettime Resolve()
+    {
+        ClockGettime clockGettime = State<>::function.load(std::memory_order_relaxed);
+        if (clockGettime == nullptr)
+        {
+            clockGettime = Lookup();
+            State<>::function.store(clockGettime, std::memory_order_relaxed);
+        }
+        return clockGettime;
+    }
+
+    static ClockGettime Lookup()
+    {
+        // The name differs between architectures.
+        void* symbol = FindVdsoSymbol("__vdso_clock_gettime");
+        if (symbol == nullptr)
+            symbol = FindVdsoSymbol("__kernel_clock_gettime");
+        if (symbol == nullptr)
+            return &SystemCall;
+        State<>::resolved.store(true, std::memory_order_relaxed);
+        return reinterpret_cast<ClockGettime>(symbol);
+    }
+
+    //! Look up a function in the vDSO's dynamic symbol table.
+    //! @return The address of the function, or nullptr if not found.
+    static void* FindVdsoSymbol(const char* name)
+    {
+        const std::uintptr_t base = static_cast<std::uintptr_t>(getauxval(AT_SYSINFO_EHDR));
+        if (base == 0)
+            return nullptr;
+        const ElfW(Ehdr)* header = reinterpret_cast<const ElfW(Ehdr)*>(base);
+        if (std::memcmp(header->e_ident, ELFMAG, SELFMAG) != 0)
+            return nullptr;
+
+        // Symbol values are virtual addresses relative to the first PT_LOAD segment.
+        const ElfW(Phdr)* segments = reinterpret_cast<const ElfW(Phdr)*>(base + header->e_phoff);
+        std::uintptr_t loadOffset = 0;
+        bool           loadFound = false;
+        const ElfW(Dyn)* dynamic = nullptr;
+        for (int i = 0; i < header->e_phnum; ++i)
+        {
+            if (segments[i].p_type == PT_LOAD && !loadFound)
+            {
+                loadOffset = base + segments[i].p_offset - segments[i].p_vaddr;
+                loadFound = true;
+            }
+            else if (segments[i].p_type == PT_DYNAMIC)
+            {
+                dynamic = reinterpret_cast<const ElfW(Dyn)*>(base + segments[i].p_offset);
+            }
+        }
+        if (!loadFound || dynamic == nullptr)
+            return nullptr;
+
+        const char*         strings = nullptr;
+        const ElfW(Sym)*    symbols = nullptr;
+        const std::uint32_t* hash = nullptr;
+        const std::uint32_t* gnuHash = nullptr;
+        for (const ElfW(Dyn)* entry = dynamic; entry->d_tag != DT_NULL; ++entry)
+        {
+            const std::uintptr_t address = loadOffset + entry->d_un.d_ptr;
+            switch (entry->d_tag)
+            {
+            case DT_STRTAB:   strings = reinterpret_cast<const char*>(address); break;
+            case DT_SYMTAB:   symbols = reinterpret_cast<const ElfW(Sym)*>(address); break;
+            case DT_HASH:     hash = reinterpret_cast<const std::uint32_t*>(address); break;
+            case DT_GNU_HASH: gnuHash = reinterpret_cast<const std::uint32_t*>(address); break;
+            default: break;
+            }
+        }
+        if (strings == nullptr || symbols == nullptr)
+            return nullptr;
+
+        std::uint32_t count = 0;
+        if (hash != nullptr)
+            count = hash[1];  // nchain is the number of symbols.
+        else if (gnuHash != nullptr)
+            count = CountGnuHashSymbols(gnuHash);
+
+        for (std::uint32_t i = 0; i < count; ++i)
+        {
+            const ElfW(Sym)& symbol = symbols[i];
+            const unsigned type = symbol.st_info & 0xf;
+            const unsigned binding = symbol.st_info >> 4;
+            if (type != STT_FUNC || symbol.st_shndx == SHN_UNDEF)
+                continue;
+            if (binding != STB_GLOBAL && binding != STB_WEAK)
+                continue;
+            if (std::strcmp(strings + symbol.st_name, name) == 0)
+                return reinterpret_cast<void*>(loadOffset + symbol.st_value);
+        }
+        return nullptr;
+    }
+
+    // DT_GNU_HASH doesn't store the symbol count. It is one past the last symbol of the
+    // chain that starts at the highest bucket.
+    static std::uint32_t CountGnuHashSymbols(const std::uint32_t* table)
+    {
+        const std::uint32_t  bucketCount = table[0];
+        const std::uint32_t  symbolOffset = table[1];
+        const std::uint32_t  bloomSize = table[2];
+        const std::uint32_t* buckets = table + 4 + bloomSize * (sizeof(ElfW(Addr)) / 4);
+        const std::uint32_t* chains = buckets + bucketCount;
+
+        std::uint32_t last = 0;
+        for (std::uint32_t i = 0; i < bucketCount; ++i)
+        {
+            if (buckets[i] > last)
+                last = buckets[i];
+        }
+        if (last < symbolOffset)
+            return symbolOffset;
+        while ((chains[last - symbolOffset] & 1) == 0)
+            ++last;
+        return last + 1;
+    }
+#endif  // defined(__linux__)
+};
+
+#if defined(__linux__)
+template <class T>
+std::atomic<VdsoClock11::ClockGettime> VdsoClock11::State<T>::function(VdsoClock11::Lookup());
+
+template <class T>
+std::atomic<bool> VdsoClock11::State<T>::resolved(false);
+#endif
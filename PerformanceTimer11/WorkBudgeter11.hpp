@@ -0,0 +1,172 @@
+// ==================================================================
+// BSD 3-Clause License
+//
+// Copyright (c) 2017-2020, Alexander K. Freed
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// ==================================================================
+
+
+// Language: ISO C++11
+
+#pragma once
+
+#include "PerformanceTimer11.hpp"
+
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+//! Fills the time left in a timer's interval with optional work (garbage collection,
+//! refinement, cache warming, ...) without overrunning it.
+//! Work is split into small quanta of a few types. The cost of each type is learned
+//! online, and a quantum only runs if its predicted cost fits in the remaining time.
+//! e.g.
+//!     WorkBudgeter11<> budgeter(timer, 2);
+//!     // After the required work of the frame:
+//!     budgeter.RunWhile(0, [&] { return collector.Step(); });
+//!     budgeter.RunWhile(1, [&] { return cache.WarmOne(); });
+template <class Timer = PerformanceTimer11>
+class WorkBudgeter11
+{
+public:
+    //! @param[in] timer The timer regulating the loop. Its interval is the budget.
+    //! @param[in] quantumTypes The number of different kinds of quanta.
+    WorkBudgeter11(Timer& timer, std::size_t quantumTypes)
+        : m_timer(timer)
+        , m_costs(quantumTypes)
+        , m_reserve(0)
+        , m_deviations(2)
+    {
+    }
+
+    //! Set the time to keep free at the end of the interval (e.g. for the wait loop's
+    //! scheduling latency). Unit is milliseconds. Default is 0.
+    void SetReserve(double milliseconds)
+    {
+        m_reserve = milliseconds;
+    }
+
+    //! Set how many mean deviations are added to the average cost when predicting.
+    //! Higher values overrun less often but leave more time unused. Default is 2.
+    void SetSafetyFactor(double deviations)
+    {
+        m_deviations = deviations;
+    }
+
+    //! Give a starting estimate for a quantum type. Without one, the first quantum of a
+    //! type runs whenever any time is left, to learn its cost.
+    //! @param[in] type The quantum type.
+    //! @param[in] milliseconds The expected cost of one quantum.
+    void SetInitialCost(std::size_t type, double milliseconds)
+    {
+        assert(type < m_costs.size());
+        Cost& cost = m_costs[type];
+        cost.mean = milliseconds;
+        cost.deviation = milliseconds / 2;
+        cost.samples = 1;
+    }
+
+    //! @return The predicted cost of one quantum of the type in milliseconds.
+    double GetPredictedCost(std::size_t type) const
+    {
+        assert(type < m_costs.size());
+        const Cost& cost = m_costs[type];
+        return cost.mean + m_deviations * cost.deviation;
+    }
+
+    //! @return The time left in the interval after the reserve, in milliseconds.
+    //! Updates the timer's stop point.
+    double GetAvailable()
+    {
+        m_timer.Stop();
+        return m_timer.GetRemaining() - m_reserve;
+    }
+
+    //! Run one quantum if its predicted cost fits in the time left.
+    //! @param[in] type The quantum type.
+    //! @param[in] quantum The work. Any return value is ignored.
+    //! @return true if the quantum ran.
+    template <class Quantum>
+    bool TryRun(std::size_t type, Quantum&& quantum)
+    {
+        assert(type < m_costs.size());
+        const double available = GetAvailable();
+        if (available <= 0 || GetPredictedCost(type) > available)
+            return false;
+        const double begin = m_timer.GetElapsed();
+        quantum();
+        m_timer.Stop();
+        Learn(m_costs[type], m_timer.GetElapsed() - begin);
+        return true;
+    }
+
+    //! Run quanta of one type while they fit in the time left and there is work to do.
+    //! @param[in] type The quantum type.
+    //! @param[in] quantum The work. Returns false when there is nothing more to do.
+    //! @return The number of quanta that ran.
+    template <class Quantum>
+    std::size_t RunWhile(std::size_t type, Quantum&& quantum)
+    {
+        std::size_t count = 0;
+        bool more = true;
+        while (more && TryRun(type, [&] { more = quantum(); }))
+            ++count;
+        return count;
+    }
+
+private:
+    struct Cost
+    {
+        double      mean = 0;
+        double      deviation = 0;
+        std::size_t samples = 0;
+    };
+
+    // Exponentially weighted mean and mean deviation, with the same gains as TCP's
+    // RTT estimator (1/8 and 1/4). The first sample initializes both.
+    static void Learn(Cost& cost, double sample)
+    {
+        if (cost.samples == 0)
+        {
+            cost.mean = sample;
+            cost.deviation = sample / 2;
+        }
+        else
+        {
+            cost.deviation += (std::fabs(sample - cost.mean) - cost.deviation) / 4;
+            cost.mean += (sample - cost.mean) / 8;
+        }
+        ++cost.samples;
+    }
+
+    Timer&            m_timer;
+    std::vector<Cost> m_costs;
+    double            m_reserve;
+    double            m_deviations;
+};
@@ -0,0 +1,356 @@
+// ==================================================================
+// BSD 3-Clause License
+//
+// Copyright (c) 2017-2020, Alexander K. Freed
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// ==================================================================
+
+
+// Language: ISO C++11
+
+// The zones each thread is currently inside, readable at any moment: from a signal
+// handler on the same thread (crashes), or from another thread (stalls). Every
+// ZoneTimer11 pushes itself on its thread's stack. Reading and dumping take no locks
+// and allocate nothing; the dump formats numbers itself and uses only write(), so it
+// is async-signal-safe.
+//
+//     // Crash dumps: all threads' zones go to stderr before the default action.
+//     ZoneStack11::InstallCrashHandler(STDERR_FILENO);
+//
+//     // Stall dumps, from a watchdog thread:
+//     ZoneStack11::DumpAll(fd);
+//
+// The stacks live in a fixed static pool that is never freed, so a reader can't see a
+// stack disappear. A thread claims a slot on its first zone and releases it on exit.
+// Threads beyond the pool size, and zones nested beyond the maximum depth, still work
+// but aren't shown.
+
+#pragma once
+
+#include "TickClock11.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__linux__) || defined(__unix__) || defined(__APPLE__)
+#include <cerrno>
+#include <csignal>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+#define PERFORMANCETIMER11_ZONE_STACK_POSIX
+#endif
+
+class TimerSite11;
+
+//! The zone stack of one thread.
+class ZoneStack11
+{
+public:
+    static const std::uint32_t MaxDepth = 32;
+    static const std::uint32_t MaxThreads = 256;
+
+    //! @return The calling thread's stack, claiming a slot on first use, or nullptr if
+    //!         the pool is exhausted. Not async-signal-safe on first use.
+    static ZoneStack11* ForThread()
+    {
+        ZoneStack11*& stack = Current();
+        if (stack == nullptr)
+            stack = Claim();
+        return stack;
+    }
+
+    //! @return The calling thread's stack, or nullptr if it has never entered a zone.
+    //!         Async-signal-safe.
+    static ZoneStack11* GetCurrent()
+    {
+        return Current();
+    }
+
+    //! Enter a zone. Only called by the owning thread.
+    void Push(const TimerSite11* site, const char* name, TickClock11::Ticks start)
+    {
+        const std::uint32_t depth = m_depth.load(std::memory_order_relaxed);
+        if (depth < MaxDepth)
+        {
+            m_frames[depth].site.store(site, std::memory_order_relaxed);
+            m_frames[depth].name.store(name, std::memory_order_relaxed);
+            m_frames[depth].start.store(start, std::memory_order_relaxed);
+        }
+        m_depth.store(depth + 1, std::memory_order_release);
+    }
+
+    //! Leave the innermost zone. Only called by the owning thread.
+    void Pop()
+    {
+        m_depth.store(m_depth.load(std::memory_order_relaxed) - 1, std::memory_order_release);
+    }
+
+    //! @return The number of zones entered and not yet left, including those beyond MaxDepth.
+    std::uint32_t GetDepth() const
+    {
+        return m_depth.load(std::memory_order_acquire);
+    }
+
+    //! @return The site of the zone at a depth (0 is outermost), or nullptr if not recorded.
+    const TimerSite11* GetSite(std::uint32_t depth) const
+    {
+        return depth < MaxDepth ? m_frames[depth].site.load(std::memory_order_relaxed) : nullptr;
+    }
+
+    //! @return The name of the zone at a depth, or nullptr if not recorded.
+    const char* GetName(std::uint32_t depth) const
+    {
+        return depth < MaxDepth ? m_frames[depth].name.load(std::memory_order_relaxed) : nullptr;
+    }
+
+    //! @return The time the zone at a depth was entered, or 0 if not recorded.
+    TickClock11::Ticks GetStart(std::uint32_t depth) const
+    {
+        return depth < MaxDepth ? m_frames[depth].start.load(std::memory_order_relaxed) : 0;
+    }
+
+    //! @return The site of the innermost recorded zone, or nullptr outside any zone.
+    const TimerSite11* GetInnermost() const
+    {
+        const std::uint32_t depth = GetDepth();
+        if (depth == 0)
+            return nullptr;
+        return GetSite(depth < MaxDepth ? depth - 1 : MaxDepth - 1);
+    }
+
+    //! @return The OS id of the owning thread.
+    long GetThreadId() const
+    {
+        return m_threadId.load(std::memory_order_relaxed);
+    }
+
+    //! Write the zones of the calling thread. Async-signal-safe.
+    //! @param[in] fd The file descriptor to write to.
+    static void DumpThread(int fd)
+    {
+        const ZoneStack11* stack = GetCurrent();
+        if (stack != nullptr)
+            stack->Dump(fd, TickClock11::Now());
+    }
+
+    //! Write the zones of every thread that is inside one. Async-signal-safe. Other
+    //! threads keep running, so each stack is a best-effort snapshot.
+    //! @param[in] fd The file descriptor to write to.
+    static void DumpAll(int fd)
+    {
+        const TickClock11::Ticks now = TickClock11::Now();
+        for (std::uint32_t i = 0; i < MaxThreads; ++i)
+        {
+            const ZoneStack11& stack = Pool()[i];
+            if (stack.m_used.load(std::memory_order_acquire) && stack.GetDepth() != 0)
+                stack.Dump(fd, now);
+        }
+    }
+
+#if defined(PERFORMANCETIMER11_ZONE_STACK_POSIX)
+    //! Dump all threads' zones when the process crashes (SIGSEGV, SIGBUS, SIGFPE,
+    //! SIGILL, SIGABRT), then continue with the default action.
+    //! @param[in] fd The file descriptor to write to, e.g. STDERR_FILENO.
+    static void InstallCrashHandler(int fd)
+    {
+        DumpFd().store(fd, std::memory_order_relaxed);
+        static const int signals[] = { SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT };
+        for (int signal : signals)
+        {
+            struct sigaction action = {};
+            action.sa_handler = &CrashHandler;
+            action.sa_flags = SA_RESETHAND | SA_NODEFER;
+            sigemptyset(&action.sa_mask);
+            sigaction(signal, &action, nullptr);
+        }
+    }
+#endif
+
+private:
+    struct Frame
+    {
+        std::atomic<const TimerSite11*> site;
+        std::atomic<const char*>        name;
+        std::atomic<TickClock11::Ticks> start;
+    };
+
+    // Gives the slot back when the thread exits.
+    struct Releaser
+    {
+        ~Releaser()
+        {
+            ZoneStack11*& stack = Current();
+            if (stack != nullptr)
+            {
+                stack->m_depth.store(0, std::memory_order_relaxed);
+                stack->m_used.store(false, std::memory_order_release);
+                stack = nullptr;
+            }
+        }
+    };
+
+    static ZoneStack11*& Current()
+    {
+        static thread_local ZoneStack11* stack = nullptr;
+        return stack;
+    }
+
+    static ZoneStack11* Pool()
+    {
+        static ZoneStack11 pool[MaxThreads];
+        return pool;
+    }
+
+    static std::atomic<int>& DumpFd()
+    {
+        static std::atomic<int> fd(2);
+        return fd;
+    }
+
+    static ZoneStack11* Claim()
+    {
+        static thread_local Releaser releaser;
+        (void)releaser;
+        for (std::uint32_t i = 0; i < MaxThreads; ++i)
+        {
+            ZoneStack11& stack = Pool()[i];
+            bool used = false;
+            if (!stack.m_used.load(std::memory_order_relaxed)
+                && stack.m_used.compare_exchange_strong(used, true, std::memory_order_acquire))
+            {
+                stack.m_depth.store(0, std::memory_order_relaxed);
+                stack.m_threadId.store(ThreadId(), std::memory_order_relaxed);
+                return &stack;
+            }
+        }
+        return nullptr;
+    }
+
+    static long ThreadId()
+    {
+#if defined(__linux__)
+        return static_cast<long>(syscall(SYS_gettid));
+#else
+        return 0;
+#endif
+    }
+
+#if defined(PERFORMANCETIMER11_ZONE_STACK_POSIX)
+    static void CrashHandler(int signal)
+    {
+        const int fd = DumpFd().load(std::memory_order_relaxed);
+        static const char header[] = "zones at crash (signal ";
+        Write(fd, header, sizeof(header) - 1);
+        WriteNumber(fd, signal);
+        Write(fd, "):\n", 3);
+        DumpAll(fd);
+        raise(signal);
+    }
+#endif
+
+    // thread <id>:
+    //   <depth> <name> start <start ticks> elapsed <elapsed> us
+    void Dump(int fd, TickClock11::Ticks now) const
+    {
+        static const char thread[] = "thread ";
+        Write(fd, thread, sizeof(thread) - 1);
+        WriteNumber(fd, GetThreadId());
+        Write(fd, ":\n", 2);
+        const std::uint32_t depth = GetDepth();
+        for (std::uint32_t i = 0; i < depth && i < MaxDepth; ++i)
+        {
+            const char* name = GetName(i);
+            Write(fd, "  ", 2);
+            WriteNumber(fd, i);
+            Write(fd, " ", 1);
+            if (name != nullptr)
+            {
+                std::size_t length = 0;
+                while (name[length] != '\0')
+                    ++length;
+                Write(fd, name, length);
+            }
+            const TickClock11::Ticks start = GetStart(i);
+            Write(fd, " start ", 7);
+            WriteNumber(fd, static_cast<long long>(start));
+            Write(fd, " elapsed ", 9);
+            WriteNumber(fd, static_cast<long long>(TickClock11::ToMilliseconds(now - start) * 1000.0));
+            Write(fd, " us\n", 4);
+        }
+        if (depth > MaxDepth)
+        {
+            static const char more[] = "  (deeper zones not recorded)\n";
+            Write(fd, more, sizeof(more) - 1);
+        }
+    }
+
+    static void WriteNumber(int fd, long long value)
+    {
+        char buffer[24];
+        char* end = buffer + sizeof(buffer);
+        char* p = end;
+        const bool negative = value < 0;
+        unsigned long long magnitude = negative ? 0ull - static_cast<unsigned long long>(value) : static_cast<unsigned long long>(value);
+        do
+        {
+            *--p = static_cast<char>('0' + magnitude % 10);
+            magnitude /= 10;
+        } while (magnitude != 0);
+        if (negative)
+            *--p = '-';
+        Write(fd, p, static_cast<std::size_t>(end - p));
+    }
+
+    static void Write(int fd, const char* data, std::size_t size)
+    {
+#if defined(PERFORMANCETIMER11_ZONE_STACK_POSIX)
+        while (size != 0)
+        {
+            const ssize_t written = write(fd, data, size);
+            if (written < 0 && errno == EINTR)
+                continue;  // Interrupted by another signal; don't lose the rest of the dump.
+            if (written <= 0)
+                return;
+            data += written;
+            size -= static_cast<std::size_t>(written);
+        }
+#else
+        (void)fd;
+        (void)data;
+        (void)size;
+#endif
+    }
+
+    Frame                       m_frames[MaxDepth];
+    std::atomic<std::uint32_t>  m_depth;
+    std::atomic<bool>           m_used;
+    std::atomic<long>           m_threadId;
+};
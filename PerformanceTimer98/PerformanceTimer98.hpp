@@ -130,6 +130,125 @@ private:
 };
 
 
+#elif (defined (__linux__) || defined(__posix__)) && defined(__aarch64__) && !defined(PERFORMANCETIMER98_NO_CNTVCT)
+
+// ===========================================================================
+// The ARM64 version
+//
+// Reads the generic timer's virtual counter (cntvct_el0) directly instead of calling
+// gettimeofday. Linux lets user space read it. The counter is not serializing: define
+// PERFORMANCETIMER98_CNTVCT_ISB to put an isb barrier before each read, so the read
+// can't be executed ahead of the code being measured. Define PERFORMANCETIMER98_NO_CNTVCT
+// to use the generic Linux version instead. PERFORMANCETIMER98_USE_VDSO only applies to
+// the generic version, so it is ignored here unless PERFORMANCETIMER98_NO_CNTVCT is defined.
+
+#include <stdint.h>
+
+#include <cassert>
+
+//! A cross-platform high-performance timer that can be used for accurately
+//! tracking run time or controlling game loops.
+//! It works on Windows and Linux.
+class PerformanceTimer98
+{
+public:
+    PerformanceTimer98()
+        : m_startTime(0)
+        , m_stopTime(0)
+    {
+        m_perSecond = ReadFrequency();
+        m_valid = m_perSecond != 0;
+        m_interval = m_perSecond / 60.0;  // Default is 1/60th of a second.
+        m_perMillisecond = m_perSecond / 1000.0;
+    }
+
+    //! The counter frequency is set by firmware, which may leave it unset.
+    //! @return true if this system is supported.
+    bool IsSupportedPlatform() const
+    {
+        return m_valid;
+    }
+
+    //! @return The (optional) interval for managing loop timing. Unit is seconds.
+    double GetInterval() const
+    {
+        return m_interval / m_perSecond;
+    }
+
+    //! Set the (optional) interval for managing loop timing.
+    //! Unit is ticks-per-second. e.g. 60 will set the interval to 1/60th of a second.
+    //! @param[in] tickPerSecond The desired number of intervals per second.
+    void SetInterval(double ticksPerSecond)
+    {
+        if (ticksPerSecond == 0)
+        {
+            assert(false);
+            return;
+        }
+        m_interval = m_perSecond / ticksPerSecond;
+    }
+
+    //! Mark the current time as the start point and stop point.
+    void Start()
+    {
+        assert(IsSupportedPlatform());
+        m_startTime = ReadCounter();
+        m_stopTime = m_startTime;
+    }
+
+    //! Mark the current time as the stop point.
+    //! (Doesn't actually "stop" the timer--just sets the stop point.)
+    void Stop()
+    {
+        m_stopTime = ReadCounter();
+        assert(IsSupportedPlatform());
+    }
+
+    //! @return The elapsed time from start to stop in milliseconds.
+    double GetElapsed() const
+    {
+        return (m_stopTime - m_startTime) / m_perMillisecond;
+    }
+
+    //! @return The remaining time in the time interval in milliseconds. (i.e. interval - elapsed)
+    double GetRemaining() const
+    {
+        return (m_interval + m_startTime - m_stopTime) / m_perMillisecond;
+    }
+
+    //!@return true if the time between start and stop is greater than the interval.
+    bool IntervalHasElapsed() const
+    {
+        return (m_stopTime - m_startTime) >= m_interval;
+    }
+
+private:
+    static int64_t ReadCounter()
+    {
+        uint64_t ticks;
+#if defined(PERFORMANCETIMER98_CNTVCT_ISB)
+        __asm__ __volatile__("isb" : : : "memory");
+#endif
+        __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(ticks));
+        return static_cast<int64_t>(ticks);
+    }
+
+    static double ReadFrequency()
+    {
+        uint64_t frequency;
+        __asm__ __volatile__("mrs %0, cntfrq_el0" : "=r"(frequency));
+        return static_cast<double>(frequency & 0xFFFFFFFF);  // The upper 32 bits are reserved.
+    }
+
+    double  m_perSecond;
+    int64_t m_startTime;
+    int64_t m_stopTime;
+    double  m_perMillisecond;
+    double  m_interval;
+    bool    m_valid;
+};
+
+
 #elif defined (__linux__) || defined(__posix__)
 
 // ===========================================================================
@@ -141,6 +260,156 @@ private:
 #include <cstring>
 #include <cassert>
 
+#if defined(PERFORMANCETIMER98_USE_VDSO)
+
+#include <link.h>
+#include <stdint.h>
+#include <sys/auxv.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+//! Calls the kernel's vDSO gettimeofday through a cached function pointer, skipping the
+//! libc wrapper. The symbol is resolved from the vDSO image (AT_SYSINFO_EHDR) during
+//! static initialization. Falls back to the system call if it can't be found.
+//! On ARM64 this is only used with PERFORMANCETIMER98_NO_CNTVCT.
+//! (A class template so the cached pointer can be defined in this header.)
+template <class T = void>
+class PerformanceTimer98Vdso
+{
+public:
+    typedef int (*GetTimeOfDayFunction)(timeval*, void*);
+
+    static void GetTimeOfDay(timeval* tv)
+    {
+        GetTimeOfDayFunction function = s_function;
+        if (function == NULL)
+            function = s_function = Lookup();
+        function(tv, NULL);
+    }
+
+    //! @return true if gettimeofday was found in the vDSO.
+    static bool IsResolved()
+    {
+        return Lookup() != &SystemCall;
+    }
+
+private:
+    static int SystemCall(timeval* tv, void* tz)
+    {
+        return static_cast<int>(syscall(SYS_gettimeofday, tv, tz));
+    }
+
+    static GetTimeOfDayFunction Lookup()
+    {
+        // The name differs between architectures.
+        void* symbol = FindSymbol("__vdso_gettimeofday");
+        if (symbol == NULL)
+            symbol = FindSymbol("__kernel_gettimeofday");
+        if (symbol == NULL)
+            return &SystemCall;
+        return reinterpret_cast<GetTimeOfDayFunction>(symbol);
+    }
+
+    static void* FindSymbol(const char* name)
+    {
+        const uintptr_t base = static_cast<uintptr_t>(getauxval(AT_SYSINFO_EHDR));
+        if (base == 0)
+            return NULL;
+        const ElfW(Ehdr)* header = reinterpret_cast<const ElfW(Ehdr)*>(base);
+        if (std::memcmp(header->e_ident, ELFMAG, SELFMAG) != 0)
+            return NULL;
+
+        // Symbol values are virtual addresses relative to the first PT_LOAD segment.
+        const ElfW(Phdr)* segments = reinterpret_cast<const ElfW(Phdr)*>(base + header->e_phoff);
+        uintptr_t loadOffset = 0;
+        bool loadFound = false;
+        const ElfW(Dyn)* dynamic = NULL;
+        for (int i = 0; i < header->e_phnum; ++i)
+        {
+            if (segments[i].p_type == PT_LOAD && !loadFound)
+            {
+                loadOffset = base + segments[i].p_offset - segments[i].p_vaddr;
+                loadFound = true;
+            }
+            else if (segments[i].p_type == PT_DYNAMIC)
+            {
+                dynamic = reinterpret_cast<const ElfW(Dyn)*>(base + segments[i].p_offset);
+            }
+        }
+        if (!loadFound || dynamic == NULL)
+            return NULL;
+
+        const char* strings = NULL;
+        const ElfW(Sym)* symbols = NULL;
+        const uint32_t* hash = NULL;
+        const uint32_t* gnuHash = NULL;
+        for (const ElfW(Dyn)* entry = dynamic; entry->d_tag != DT_NULL; ++entry)
+        {
+            const uintptr_t address = loadOffset + entry->d_un.d_ptr;
+            if (entry->d_tag == DT_STRTAB)
+                strings = reinterpret_cast<const char*>(address);
+            else if (entry->d_tag == DT_SYMTAB)
+                symbols = reinterpret_cast<const ElfW(Sym)*>(address);
+            else if (entry->d_tag == DT_HASH)
+                hash = reinterpret_cast<const uint32_t*>(address);
+            else if (entry->d_tag == DT_GNU_HASH)
+                gnuHash = reinterpret_cast<const uint32_t*>(address);
+        }
+        if (strings == NULL || symbols == NULL)
+            return NULL;
+
+        uint32_t count = 0;
+        if (hash != NULL)
+            count = hash[1];  // nchain is the number of symbols.
+        else if (gnuHash != NULL)
+            count = CountGnuHashSymbols(gnuHash);
+
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            const ElfW(Sym)& symbol = symbols[i];
+            const unsigned type = symbol.st_info & 0xf;
+            const unsigned binding = symbol.st_info >> 4;
+            if (type != STT_FUNC || symbol.st_shndx == SHN_UNDEF)
+                continue;
+            if (binding != STB_GLOBAL && binding != STB_WEAK)
+                continue;
+            if (std::strcmp(strings + symbol.st_name, name) == 0)
+                return reinterpret_cast<void*>(loadOffset + symbol.st_value);
+        }
+        return NULL;
+    }
+
+    // DT_GNU_HASH doesn't store the symbol count. It is one past the last symbol of the
+    // chain that starts at the highest bucket.
+    static uint32_t CountGnuHashSymbols(const uint32_t* table)
+    {
+        const uint32_t  bucketCount = table[0];
+        const uint32_t  symbolOffset = table[1];
+        const uint32_t  bloomSize = table[2];
+        const uint32_t* buckets = table + 4 + bloomSize * (sizeof(ElfW(Addr)) / 4);
+        const uint32_t* chains = buckets + bucketCount;
+
+        uint32_t last = 0;
+        for (uint32_t i = 0; i < bucketCount; ++i)
+        {
+            if (buckets[i] > last)
+                last = buckets[i];
+        }
+        if (last < symbolOffset)
+            return symbolOffset;
+        while ((chains[last - symbolOffset] & 1) == 0)
+            ++last;
+        return last + 1;
+    }
+
+    static GetTimeOfDayFunction s_function;
+};
+
+template <class T>
+typename PerformanceTimer98Vdso<T>::GetTimeOfDayFunction PerformanceTimer98Vdso<T>::s_function = PerformanceTimer98Vdso<T>::Lookup();
+
+#endif  // defined(PERFORMANCETIMER98_USE_VDSO)
+
 //! A cross-platform high-performance timer that can be used for accurately
 //! tracking run time or controlling game loops.
 //! It works on Windows and Linux.
@@ -184,7 +453,7 @@ public:
     //! Mark the current time as the start point and stop point.
     void Start()
     {
-        gettimeofday(&m_startTime, NULL);
+        Now(&m_startTime);
         m_stopTime = m_startTime;
     }
 
@@ -192,7 +461,7 @@ public:
     //! (Doesn't actually "stop" the timer--just sets the stop point.)
     void Stop()
     {
-        gettimeofday(&m_stopTime, NULL);
+        Now(&m_stopTime);
     }
 
     //! @return The elapsed time from start to stop in milliseconds.
@@ -218,6 +487,15 @@ public:
     }
 
 private:
+    static void Now(timeval* tv)
+    {
+#if defined(PERFORMANCETIMER98_USE_VDSO)
+        PerformanceTimer98Vdso<>::GetTimeOfDay(tv);
+#else
+        gettimeofday(tv, NULL);
+#endif
+    }
+
     timeval m_startTime;
     timeval m_stopTime;
     double  m_interval;